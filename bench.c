@@ -0,0 +1,287 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+
+#include "bench.h"
+#include "stb_ds.h"
+
+#define BENCH_LINE_SIZE 4096
+
+typedef enum {
+	BENCH_CLICK,
+	BENCH_WHEEL,
+	BENCH_KEY,
+	BENCH_TEXT,
+	BENCH_EDIT,
+	BENCH_RESIZE,
+
+	// Events SDL queued itself while the script ran, like glyph uploads
+	BENCH_QUEUED,
+
+	// Applying the commands queued by a batch of events, once per batch
+	BENCH_APPLY,
+
+	BENCH_KINDS,
+} bench_kind;
+
+static const char* bench_kind_names[BENCH_KINDS] = {
+	"click",
+	"wheel",
+	"key queue",
+	"text queue",
+	"edit",
+	"resize",
+	"sdl queued",
+	"apply",
+};
+
+typedef struct {
+	bench_kind kind;
+	bool frame;
+	SDL_Event event;
+} bench_step;
+
+// Adds the step to the script count times
+static void
+bench_add(bench_step** steps, bench_step step, long count)
+{
+	for (long i = 0; i < count; i++) {
+		arrput(*steps, step);
+	}
+}
+
+// Splits text into as many events as it takes, like SDL does, never in the
+// middle of a rune
+static void
+bench_add_text(bench_step** steps, const char* text, long count)
+{
+	size_t len = strlen(text);
+	for (long i = 0; i < count; i++) {
+		size_t at = 0;
+		while (at < len) {
+			size_t n = len - at;
+			if (n > SDL_TEXTINPUTEVENT_TEXT_SIZE - 1) {
+				n = SDL_TEXTINPUTEVENT_TEXT_SIZE - 1;
+				while (n > 0 && (text[at + n] & 0xC0) == 0x80) {
+					n--;
+				}
+			}
+
+			bench_step step = { .kind = BENCH_TEXT, .frame = false };
+			step.event.text.type = SDL_TEXTINPUT;
+			memcpy(step.event.text.text, &text[at], n);
+			step.event.text.text[n] = '\0';
+			arrput(*steps, step);
+			at += n;
+		}
+	}
+}
+
+// Parses one line of the script, returns false if it isn't understood
+static bool
+bench_parse_line(bench_step** steps, char* line)
+{
+	line[strcspn(line, "\r\n")] = '\0';
+
+	char* p = line + strspn(line, " \t");
+	if (*p == '\0' || *p == '#') {
+		return true;
+	}
+
+	// Optional repeat count
+	long count = 1;
+	if (*p >= '0' && *p <= '9') {
+		count = strtol(p, &p, 10);
+		p += strspn(p, " \t");
+	}
+
+	size_t name_len = strcspn(p, " \t");
+	char* args = p + name_len + strspn(p + name_len, " \t");
+	bench_step step = { .frame = false };
+
+	if (name_len == 5 && strncmp(p, "click", 5) == 0) {
+		step.kind = BENCH_CLICK;
+		step.event.button.type = SDL_MOUSEBUTTONDOWN;
+		step.event.button.button = SDL_BUTTON_LEFT;
+		step.event.button.state = SDL_PRESSED;
+		step.event.button.clicks = 1;
+		if (sscanf(args, "%d %d", &step.event.button.x, &step.event.button.y) != 2) {
+			return false;
+		}
+	} else if (name_len == 5 && strncmp(p, "wheel", 5) == 0) {
+		step.kind = BENCH_WHEEL;
+		step.event.wheel.type = SDL_MOUSEWHEEL;
+		step.event.wheel.direction = SDL_MOUSEWHEEL_NORMAL;
+		if (sscanf(args, "%d", &step.event.wheel.y) != 1) {
+			return false;
+		}
+	} else if (name_len == 3 && strncmp(p, "key", 3) == 0) {
+		step.kind = BENCH_KEY;
+		step.event.key.type = SDL_KEYDOWN;
+		step.event.key.state = SDL_PRESSED;
+		step.event.key.keysym.sym = SDL_GetKeyFromName(args);
+		step.event.key.keysym.scancode = SDL_GetScancodeFromKey(step.event.key.keysym.sym);
+		if (step.event.key.keysym.sym == SDLK_UNKNOWN) {
+			return false;
+		}
+	} else if (name_len == 4 && strncmp(p, "text", 4) == 0) {
+		bench_add_text(steps, args, count);
+		return true;
+	} else if (name_len == 4 && strncmp(p, "edit", 4) == 0) {
+		step.kind = BENCH_EDIT;
+		step.event.edit.type = SDL_TEXTEDITING;
+		SDL_strlcpy(step.event.edit.text, args, SDL_TEXTEDITINGEVENT_TEXT_SIZE);
+		step.event.edit.start = (Sint32) SDL_utf8strlen(step.event.edit.text);
+		step.event.edit.length = 0;
+	} else if (name_len == 6 && strncmp(p, "resize", 6) == 0) {
+		step.kind = BENCH_RESIZE;
+		step.event.window.type = SDL_WINDOWEVENT;
+		step.event.window.event = SDL_WINDOWEVENT_RESIZED;
+		if (sscanf(args, "%d %d", &step.event.window.data1, &step.event.window.data2) != 2) {
+			return false;
+		}
+	} else if (name_len == 5 && strncmp(p, "frame", 5) == 0) {
+		step.frame = true;
+	} else {
+		return false;
+	}
+
+	bench_add(steps, step, count);
+	return true;
+}
+
+static int
+bench_compare(const void* a, const void* b)
+{
+	Uint64 x = *(const Uint64*) a;
+	Uint64 y = *(const Uint64*) b;
+	return x < y ? -1 : x > y;
+}
+
+// Returns the percentile of the sorted samples in microseconds
+static double
+bench_percentile(const Uint64* sorted, double percent, double us_per_tick)
+{
+	size_t n = arrlenu(sorted);
+	if (n == 0) {
+		return 0;
+	}
+
+	return sorted[(size_t) ((n - 1) * percent / 100.0 + 0.5)] * us_per_tick;
+}
+
+// Ends a batch the way the main loop does, events SDL queued meanwhile first.
+// Frames are timed from applying the batch to having drawn it.
+static void
+bench_frame(bench_event_fn handle_event, bench_batch_fn apply, bench_batch_fn draw, Uint64** samples, Uint64** frames)
+{
+	SDL_Event e;
+	while (SDL_PollEvent(&e)) {
+		Uint64 start = SDL_GetPerformanceCounter();
+		handle_event(&e);
+		arrput(samples[BENCH_QUEUED], SDL_GetPerformanceCounter() - start);
+	}
+
+	Uint64 start = SDL_GetPerformanceCounter();
+	apply();
+	Uint64 applied = SDL_GetPerformanceCounter();
+	draw();
+	arrput(samples[BENCH_APPLY], applied - start);
+	arrput(*frames, SDL_GetPerformanceCounter() - start);
+}
+
+bool
+bench_run(const char* path, bench_event_fn handle_event, bench_batch_fn apply, bench_batch_fn draw)
+{
+	FILE* file = fopen(path, "r");
+	if (!file) {
+		fprintf(stderr, "Error opening bench script %s\n", path);
+		return false;
+	}
+
+	// The whole script is parsed up front so none of it is timed
+	bench_step* steps = NULL;
+	char line[BENCH_LINE_SIZE];
+	int line_number = 0;
+	bool parsed = true;
+	while (parsed && fgets(line, sizeof(line), file)) {
+		line_number++;
+		parsed = bench_parse_line(&steps, line);
+	}
+	fclose(file);
+
+	if (!parsed) {
+		fprintf(stderr, "Error in bench script %s line %d: %s\n", path, line_number, line);
+		arrfree(steps);
+		return false;
+	}
+
+	Uint64* samples[BENCH_KINDS] = { NULL };
+	Uint64* frames = NULL;
+	size_t events = 0;
+
+	Uint64 run_start = SDL_GetPerformanceCounter();
+
+	for (size_t i = 0; i < arrlenu(steps); i++) {
+		if (steps[i].frame) {
+			bench_frame(handle_event, apply, draw, samples, &frames);
+			continue;
+		}
+
+		steps[i].event.common.timestamp = SDL_GetTicks();
+
+		Uint64 start = SDL_GetPerformanceCounter();
+		handle_event(&steps[i].event);
+		arrput(samples[steps[i].kind], SDL_GetPerformanceCounter() - start);
+		events++;
+	}
+
+	// A script that doesn't end on a frame still gets drawn
+	if (arrlenu(steps) == 0 || !steps[arrlenu(steps) - 1].frame) {
+		bench_frame(handle_event, apply, draw, samples, &frames);
+	}
+
+	Uint64 run_ticks = SDL_GetPerformanceCounter() - run_start;
+	double us_per_tick = 1e6 / (double) SDL_GetPerformanceFrequency();
+	double run_ms = run_ticks * us_per_tick / 1000.0;
+
+	printf("bench: %s\n", path);
+	printf("%zu events, %zu frames in %.2f ms: %.0f events/s, %.0f frames/s\n",
+		events, arrlenu(frames), run_ms, events / (run_ms / 1000.0), arrlenu(frames) / (run_ms / 1000.0));
+
+	printf("%-12s %8s %10s %10s %10s %10s\n", "event", "count", "mean us", "p50 us", "p99 us", "max us");
+	for (int k = 0; k < BENCH_KINDS; k++) {
+		size_t n = arrlenu(samples[k]);
+		if (n == 0) {
+			continue;
+		}
+
+		Uint64 total = 0;
+		for (size_t i = 0; i < n; i++) {
+			total += samples[k][i];
+		}
+
+		qsort(samples[k], n, sizeof(Uint64), bench_compare);
+		printf("%-12s %8zu %10.2f %10.2f %10.2f %10.2f\n", bench_kind_names[k], n,
+			total * us_per_tick / n,
+			bench_percentile(samples[k], 50, us_per_tick),
+			bench_percentile(samples[k], 99, us_per_tick),
+			samples[k][n - 1] * us_per_tick);
+		arrfree(samples[k]);
+	}
+
+	printf("key and text events only queue commands, apply times each batch applying them\n");
+
+	qsort(frames, arrlenu(frames), sizeof(Uint64), bench_compare);
+	printf("frame ms: p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n",
+		bench_percentile(frames, 50, us_per_tick) / 1000.0,
+		bench_percentile(frames, 90, us_per_tick) / 1000.0,
+		bench_percentile(frames, 99, us_per_tick) / 1000.0,
+		bench_percentile(frames, 100, us_per_tick) / 1000.0);
+
+	arrfree(frames);
+	arrfree(steps);
+	return true;
+}
@@ -0,0 +1,35 @@
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+
+/*
+ * Function the benchmark hands every scripted event to.
+ */
+typedef void (*bench_event_fn)(const SDL_Event* e);
+
+/*
+ * Functions the benchmark calls at the end of every batch of events, first to
+ * apply the edits the batch queued up, then to draw the window if anything
+ * changed, like the main loop does before waiting again.
+ */
+typedef void (*bench_batch_fn)(void);
+
+/*
+ * Replays the event script at the path through the event and batch functions
+ * as fast as possible, then prints the time taken by each kind of event and
+ * by applying each batch, the frame time percentiles from applying a batch to
+ * having drawn it, and the throughput. Returns false if the script couldn't be
+ * read.
+ *
+ * Scripts have one event per line, optionally preceded by a repeat count:
+ *
+ *   click <x> <y>       mouse button press
+ *   wheel <y>           mouse wheel notches, positive is up
+ *   key <name>          key press, named as by SDL_GetKeyFromName
+ *   text <utf8>         text input, the rest of the line
+ *   edit [<utf8>]       IME composition, nothing to end it
+ *   resize <w> <h>      window resize
+ *   frame               end of a batch
+ *
+ * Blank lines and lines starting with # are skipped.
+ */
+bool bench_run(const char* path, bench_event_fn handle_event, bench_batch_fn apply, bench_batch_fn draw);
@@ -0,0 +1,22 @@
+#define _POSIX_C_SOURCE 199309L
+#include <stddef.h>
+#include <time.h>
+
+#include "bench_util.h"
+
+const bench_script bench_scripts[] = {
+	{ "ascii", "The quick brown fox jumps over the lazy dog. " },
+	{ "latin", "Ça va très bien, où est la gare? Schön, grüß dich. " },
+	{ "cjk", "東京は日本の首都です。天気がいいですね。" },
+	{ "emoji", "😀🎉👍🚀🌏🍕🐍💡" },
+};
+
+const size_t bench_script_count = sizeof(bench_scripts) / sizeof(bench_scripts[0]);
+
+double
+bench_seconds(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
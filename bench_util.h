@@ -0,0 +1,19 @@
+#include <stddef.h>
+
+/*
+ * Text in a script, repeated by the benchmarks to fill out whatever size of
+ * text they run on.
+ */
+typedef struct {
+	const char* name;
+	const char* sample;
+} bench_script;
+
+extern const bench_script bench_scripts[];
+extern const size_t bench_script_count;
+
+/*
+ * Returns the time in seconds of a monotonic clock, only meaningful as the
+ * difference between two calls.
+ */
+double bench_seconds(void);
@@ -0,0 +1,94 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "command.h"
+#include "stb_ds.h"
+
+typedef struct {
+	command_kind kind;
+	size_t count;
+
+	// Offset of the NUL terminated insert text in the queue bytes
+	size_t text;
+} command_entry;
+
+struct command_queue {
+	command_entry* entries;
+
+	// Insert texts one after the other, only the last entry ever grows
+	char* bytes;
+};
+
+command_queue*
+command_create(void)
+{
+	return calloc(1, sizeof(command_queue));
+}
+
+void
+command_free(command_queue* queue)
+{
+	if (!queue) {
+		return;
+	}
+
+	arrfree(queue->entries);
+	arrfree(queue->bytes);
+	free(queue);
+}
+
+void
+command_push(command_queue* queue, command_kind kind, const char* text)
+{
+	size_t len = kind == COMMAND_INSERT && text ? strlen(text) : 0;
+	size_t count = arrlenu(queue->entries);
+
+	if (count > 0 && queue->entries[count - 1].kind == kind) {
+		command_entry* last = &queue->entries[count - 1];
+		last->count++;
+
+		// The last text ends the bytes, so it grows in place over its NUL
+		if (kind == COMMAND_INSERT) {
+			size_t end = arrlenu(queue->bytes) - 1;
+			arrsetlen(queue->bytes, end + len + 1);
+			memcpy(&queue->bytes[end], text, len + 1);
+		}
+		return;
+	}
+
+	command_entry entry = { .kind = kind, .count = 1, .text = arrlenu(queue->bytes) };
+	if (kind == COMMAND_INSERT) {
+		arrsetlen(queue->bytes, entry.text + len + 1);
+		memcpy(&queue->bytes[entry.text], text ? text : "", len + 1);
+	}
+	arrput(queue->entries, entry);
+}
+
+size_t
+command_count(command_queue* queue)
+{
+	return arrlenu(queue->entries);
+}
+
+command
+command_get(command_queue* queue, size_t index)
+{
+	command_entry* entry = &queue->entries[index];
+	return (command){
+		.kind = entry->kind,
+		.count = entry->count,
+		.text = entry->kind == COMMAND_INSERT ? &queue->bytes[entry->text] : NULL,
+	};
+}
+
+void
+command_clear(command_queue* queue)
+{
+	if (queue->entries) {
+		arrdeln(queue->entries, 0, arrlenu(queue->entries));
+	}
+	if (queue->bytes) {
+		arrdeln(queue->bytes, 0, arrlenu(queue->bytes));
+	}
+}
@@ -0,0 +1,60 @@
+#include <stddef.h>
+
+/*
+ * Edit commands queued up while a batch of events is handled. A command pushed
+ * right after one of the same kind is merged into it, so a held down key that
+ * repeats many times in a batch becomes a single edit of the text.
+ */
+typedef struct command_queue command_queue;
+
+typedef enum {
+	COMMAND_INSERT,
+	COMMAND_BACKSPACE,
+	COMMAND_DELETE,
+	COMMAND_LEFT,
+	COMMAND_RIGHT,
+	COMMAND_UP,
+	COMMAND_DOWN,
+} command_kind;
+
+/*
+ * A run of merged commands. Inserts carry the UTF-8 text of the whole run,
+ * every other kind the number of times it repeats.
+ */
+typedef struct {
+	command_kind kind;
+	size_t count;
+	const char* text;
+} command;
+
+/*
+ * Creates an empty command queue.
+ */
+command_queue* command_create(void);
+
+/*
+ * Frees the command queue.
+ */
+void command_free(command_queue* queue);
+
+/*
+ * Queues a command, merging it into the last one if it is the same kind.
+ * The text is only used by inserts and is copied.
+ */
+void command_push(command_queue* queue, command_kind kind, const char* text);
+
+/*
+ * Returns the number of commands left after merging.
+ */
+size_t command_count(command_queue* queue);
+
+/*
+ * Returns the queued command at the index. Its text stays valid until the
+ * next command is pushed or the queue is cleared.
+ */
+command command_get(command_queue* queue, size_t index);
+
+/*
+ * Empties the queue, keeping its memory around for the next batch.
+ */
+void command_clear(command_queue* queue);
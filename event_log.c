@@ -0,0 +1,409 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+
+#include "event_log.h"
+
+// Logs start with "SDLE" and are refused on a version mismatch
+#define EVENT_LOG_MAGIC 0x454C4453
+#define EVENT_LOG_VERSION 1
+
+// Type of the record ending a batch, SDL never gives it to an event
+#define EVENT_LOG_BATCH SDL_FIRSTEVENT
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+} event_log_header;
+
+typedef struct {
+	uint32_t type;
+	uint32_t timestamp;
+
+	// Bytes of the fields following the record
+	uint32_t size;
+} event_log_record;
+
+typedef struct {
+	int32_t sym;
+	int32_t scancode;
+	uint16_t mod;
+	uint8_t state;
+	uint8_t repeat;
+} event_log_key;
+
+typedef struct {
+	int32_t x;
+	int32_t y;
+	uint8_t button;
+	uint8_t state;
+	uint8_t clicks;
+	uint8_t padding;
+} event_log_button;
+
+typedef struct {
+	int32_t x;
+	int32_t y;
+	int32_t xrel;
+	int32_t yrel;
+	uint32_t state;
+} event_log_motion;
+
+typedef struct {
+	int32_t x;
+	int32_t y;
+	uint32_t direction;
+} event_log_wheel;
+
+typedef struct {
+	int32_t data1;
+	int32_t data2;
+	uint8_t event;
+	uint8_t padding[3];
+} event_log_window;
+
+// Editing events are followed by their text, text input events only have it
+typedef struct {
+	int32_t start;
+	int32_t length;
+} event_log_edit;
+
+struct event_log {
+	// Set while recording
+	FILE* file;
+	size_t batch_count;
+
+	// Set while replaying, the whole log read up front
+	uint8_t* data;
+	size_t len;
+	size_t offset;
+
+	size_t count;
+};
+
+event_log*
+event_log_create(const char* path)
+{
+	FILE* file = fopen(path, "wb");
+	if (!file) {
+		return NULL;
+	}
+
+	event_log_header header = { .magic = EVENT_LOG_MAGIC, .version = EVENT_LOG_VERSION };
+	event_log* log = calloc(1, sizeof(event_log));
+	if (!log || fwrite(&header, sizeof(header), 1, file) != 1) {
+		fclose(file);
+		free(log);
+		return NULL;
+	}
+
+	log->file = file;
+	return log;
+}
+
+event_log*
+event_log_load(const char* path)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file) {
+		return NULL;
+	}
+
+	long len = -1;
+	if (fseek(file, 0, SEEK_END) == 0) {
+		len = ftell(file);
+	}
+
+	event_log* log = NULL;
+	if (len >= (long) sizeof(event_log_header) && fseek(file, 0, SEEK_SET) == 0) {
+		log = calloc(1, sizeof(event_log));
+	}
+
+	if (log) {
+		log->len = (size_t) len;
+		log->data = malloc(log->len);
+	}
+
+	bool ok = log && log->data && fread(log->data, 1, log->len, file) == log->len;
+	fclose(file);
+
+	if (ok) {
+		event_log_header header;
+		memcpy(&header, log->data, sizeof(header));
+		ok = header.magic == EVENT_LOG_MAGIC && header.version == EVENT_LOG_VERSION;
+	}
+
+	if (!ok) {
+		event_log_free(log);
+		return NULL;
+	}
+
+	log->offset = sizeof(event_log_header);
+	return log;
+}
+
+void
+event_log_free(event_log* log)
+{
+	if (!log) {
+		return;
+	}
+
+	if (log->file) {
+		fclose(log->file);
+	}
+
+	free(log->data);
+	free(log);
+}
+
+// Records a record and the fields after it, all in one go
+static void
+event_log_put(event_log* log, const SDL_Event* e, const void* fields, size_t fields_size, const char* text)
+{
+	size_t text_size = text ? strlen(text) : 0;
+	event_log_record record = {
+		.type = e->type,
+		.timestamp = e->common.timestamp,
+		.size = (uint32_t) (fields_size + text_size),
+	};
+
+	fwrite(&record, sizeof(record), 1, log->file);
+	if (fields_size > 0) {
+		fwrite(fields, 1, fields_size, log->file);
+	}
+	if (text_size > 0) {
+		fwrite(text, 1, text_size, log->file);
+	}
+	log->count++;
+	log->batch_count++;
+}
+
+void
+event_log_write(event_log* log, const SDL_Event* e)
+{
+	switch (e->type) {
+		case SDL_KEYDOWN:
+		case SDL_KEYUP: {
+			event_log_key key = {
+				.sym = e->key.keysym.sym,
+				.scancode = e->key.keysym.scancode,
+				.mod = e->key.keysym.mod,
+				.state = e->key.state,
+				.repeat = e->key.repeat,
+			};
+			event_log_put(log, e, &key, sizeof(key), NULL);
+			break;
+		}
+
+		case SDL_MOUSEBUTTONDOWN:
+		case SDL_MOUSEBUTTONUP: {
+			event_log_button button = {
+				.x = e->button.x,
+				.y = e->button.y,
+				.button = e->button.button,
+				.state = e->button.state,
+				.clicks = e->button.clicks,
+			};
+			event_log_put(log, e, &button, sizeof(button), NULL);
+			break;
+		}
+
+		case SDL_MOUSEMOTION: {
+			event_log_motion motion = {
+				.x = e->motion.x,
+				.y = e->motion.y,
+				.xrel = e->motion.xrel,
+				.yrel = e->motion.yrel,
+				.state = e->motion.state,
+			};
+			event_log_put(log, e, &motion, sizeof(motion), NULL);
+			break;
+		}
+
+		case SDL_MOUSEWHEEL: {
+			event_log_wheel wheel = {
+				.x = e->wheel.x,
+				.y = e->wheel.y,
+				.direction = e->wheel.direction,
+			};
+			event_log_put(log, e, &wheel, sizeof(wheel), NULL);
+			break;
+		}
+
+		case SDL_WINDOWEVENT: {
+			event_log_window window = {
+				.data1 = e->window.data1,
+				.data2 = e->window.data2,
+				.event = e->window.event,
+			};
+			event_log_put(log, e, &window, sizeof(window), NULL);
+			break;
+		}
+
+		case SDL_TEXTEDITING: {
+			event_log_edit edit = { .start = e->edit.start, .length = e->edit.length };
+			event_log_put(log, e, &edit, sizeof(edit), e->edit.text);
+			break;
+		}
+
+		case SDL_TEXTINPUT: {
+			event_log_put(log, e, NULL, 0, e->text.text);
+			break;
+		}
+
+		default: {
+			event_log_put(log, e, NULL, 0, NULL);
+			break;
+		}
+	}
+}
+
+void
+event_log_end_batch(event_log* log)
+{
+	// Batches of nothing but filtered out events would only replay as empty
+	// frames
+	if (log->batch_count == 0) {
+		return;
+	}
+	log->batch_count = 0;
+
+	event_log_record record = { .type = EVENT_LOG_BATCH, .timestamp = SDL_GetTicks(), .size = 0 };
+	fwrite(&record, sizeof(record), 1, log->file);
+	fflush(log->file);
+}
+
+// Copies the fields of a record, zeroing whatever the record is short of
+static void
+event_log_get(const uint8_t* data, size_t size, void* fields, size_t fields_size)
+{
+	memset(fields, 0, fields_size);
+	memcpy(fields, data, size < fields_size ? size : fields_size);
+}
+
+// Copies the text of a record into an event's text, cut to fit it
+static void
+event_log_get_text(const uint8_t* data, size_t size, char* text, size_t text_size)
+{
+	size_t len = size < text_size - 1 ? size : text_size - 1;
+	memcpy(text, data, len);
+	text[len] = '\0';
+}
+
+bool
+event_log_read(event_log* log, SDL_Event* e, bool* last)
+{
+	event_log_record record;
+
+	// Batch ends are only ever read past, as part of the event before them
+	do {
+		if (log->len - log->offset < sizeof(record)) {
+			return false;
+		}
+
+		memcpy(&record, &log->data[log->offset], sizeof(record));
+		if (record.size > log->len - log->offset - sizeof(record)) {
+			return false;
+		}
+
+		log->offset += sizeof(record) + record.size;
+	} while (record.type == EVENT_LOG_BATCH);
+
+	const uint8_t* data = &log->data[log->offset - record.size];
+
+	memset(e, 0, sizeof(SDL_Event));
+	e->type = record.type;
+	e->common.timestamp = record.timestamp;
+
+	switch (record.type) {
+		case SDL_KEYDOWN:
+		case SDL_KEYUP: {
+			event_log_key key;
+			event_log_get(data, record.size, &key, sizeof(key));
+			e->key.keysym.sym = key.sym;
+			e->key.keysym.scancode = key.scancode;
+			e->key.keysym.mod = key.mod;
+			e->key.state = key.state;
+			e->key.repeat = key.repeat;
+			break;
+		}
+
+		case SDL_MOUSEBUTTONDOWN:
+		case SDL_MOUSEBUTTONUP: {
+			event_log_button button;
+			event_log_get(data, record.size, &button, sizeof(button));
+			e->button.x = button.x;
+			e->button.y = button.y;
+			e->button.button = button.button;
+			e->button.state = button.state;
+			e->button.clicks = button.clicks;
+			break;
+		}
+
+		case SDL_MOUSEMOTION: {
+			event_log_motion motion;
+			event_log_get(data, record.size, &motion, sizeof(motion));
+			e->motion.x = motion.x;
+			e->motion.y = motion.y;
+			e->motion.xrel = motion.xrel;
+			e->motion.yrel = motion.yrel;
+			e->motion.state = motion.state;
+			break;
+		}
+
+		case SDL_MOUSEWHEEL: {
+			event_log_wheel wheel;
+			event_log_get(data, record.size, &wheel, sizeof(wheel));
+			e->wheel.x = wheel.x;
+			e->wheel.y = wheel.y;
+			e->wheel.direction = wheel.direction;
+			break;
+		}
+
+		case SDL_WINDOWEVENT: {
+			event_log_window window;
+			event_log_get(data, record.size, &window, sizeof(window));
+			e->window.data1 = window.data1;
+			e->window.data2 = window.data2;
+			e->window.event = window.event;
+			break;
+		}
+
+		case SDL_TEXTEDITING: {
+			event_log_edit edit;
+			event_log_get(data, record.size, &edit, sizeof(edit));
+			e->edit.start = edit.start;
+			e->edit.length = edit.length;
+
+			size_t skip = record.size < sizeof(edit) ? record.size : sizeof(edit);
+			event_log_get_text(data + skip, record.size - skip, e->edit.text, sizeof(e->edit.text));
+			break;
+		}
+
+		case SDL_TEXTINPUT: {
+			event_log_get_text(data, record.size, e->text.text, sizeof(e->text.text));
+			break;
+		}
+	}
+
+	// The batch also ends with the log, in case the recording was cut short
+	event_log_record next;
+	*last = log->len - log->offset < sizeof(next);
+	if (!*last) {
+		memcpy(&next, &log->data[log->offset], sizeof(next));
+		*last = next.type == EVENT_LOG_BATCH;
+	}
+
+	log->count++;
+	return true;
+}
+
+size_t
+event_log_count(event_log* log)
+{
+	return log->count;
+}
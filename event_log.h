@@ -0,0 +1,56 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <SDL2/SDL.h>
+
+/*
+ * A compact binary log of the events a session handled, batch by batch, to
+ * replay it later exactly as it happened. An event log is opened either for
+ * recording or for replaying, never both.
+ *
+ * Each event is a small record of its type and timestamp followed by only the
+ * fields the type carries: keys, mouse buttons, motion and wheel, window
+ * events and the text of text input and editing events. Types with nothing
+ * recorded beyond that, like user events, replay with their fields zeroed.
+ * Logs are in the byte order of the machine recording them.
+ */
+typedef struct event_log event_log;
+
+/*
+ * Creates the file at the path and starts recording to it, returns NULL if it
+ * can't be written.
+ */
+event_log* event_log_create(const char* path);
+
+/*
+ * Loads the log recorded to the file at the path for replaying, returns NULL
+ * if it can't be read or isn't an event log.
+ */
+event_log* event_log_load(const char* path);
+
+/*
+ * Closes the log, flushing whatever is left to record.
+ */
+void event_log_free(event_log* log);
+
+/*
+ * Records an event handled in the current batch.
+ */
+void event_log_write(event_log* log, const SDL_Event* e);
+
+/*
+ * Records the end of the current batch of events, unless nothing was recorded
+ * in it. Batches are flushed to the file as they end, so a crash loses at most
+ * the batch it happened in.
+ */
+void event_log_end_batch(event_log* log);
+
+/*
+ * Replays the next event, setting last if it ends its batch. Returns false
+ * once every event has been replayed, or at the first damaged record.
+ */
+bool event_log_read(event_log* log, SDL_Event* e, bool* last);
+
+/*
+ * Returns the number of events recorded or replayed so far.
+ */
+size_t event_log_count(event_log* log);
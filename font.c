@@ -0,0 +1,139 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+#include "font.h"
+
+struct font_file {
+	char* path;
+	const uint8_t* data;
+	size_t size;
+
+	// One for the loader and one for each open font
+	SDL_atomic_t refs;
+
+	bool hashed;
+	uint64_t hash;
+};
+
+static void
+font_file_release(font_file* file)
+{
+	if (SDL_AtomicAdd(&file->refs, -1) != 1) {
+		return;
+	}
+
+	munmap((void*) file->data, file->size);
+	free(file->path);
+	free(file);
+}
+
+font_file*
+font_file_load(const char* path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		SDL_SetError("Couldn't open %s", path);
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size <= 0 || st.st_size > INT32_MAX) {
+		SDL_SetError("Couldn't read %s", path);
+		close(fd);
+		return NULL;
+	}
+
+	// The mapping outlives the descriptor
+	const uint8_t* data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		SDL_SetError("Couldn't map %s", path);
+		return NULL;
+	}
+
+	font_file* file = calloc(1, sizeof(font_file));
+	char* path_copy = malloc(strlen(path) + 1);
+	if (!file || !path_copy) {
+		munmap((void*) data, (size_t) st.st_size);
+		free(file);
+		free(path_copy);
+		SDL_OutOfMemory();
+		return NULL;
+	}
+
+	strcpy(path_copy, path);
+	file->path = path_copy;
+	file->data = data;
+	file->size = (size_t) st.st_size;
+	SDL_AtomicSet(&file->refs, 1);
+
+	return file;
+}
+
+void
+font_file_free(font_file* file)
+{
+	if (file) {
+		font_file_release(file);
+	}
+}
+
+TTF_Font*
+font_file_open(font_file* file, int point_size)
+{
+	SDL_RWops* rw = SDL_RWFromConstMem(file->data, (int) file->size);
+	if (!rw) {
+		return NULL;
+	}
+
+	// The font closes the RWops when it is closed, but never the mapping
+	TTF_Font* font = TTF_OpenFontRW(rw, 1, point_size);
+	if (font) {
+		SDL_AtomicAdd(&file->refs, 1);
+	}
+
+	return font;
+}
+
+void
+font_file_close(font_file* file, TTF_Font* font)
+{
+	if (!font) {
+		return;
+	}
+
+	TTF_CloseFont(font);
+	font_file_release(file);
+}
+
+const char*
+font_file_path(font_file* file)
+{
+	return file->path;
+}
+
+uint64_t
+font_file_hash(font_file* file)
+{
+	if (!file->hashed) {
+		uint64_t h = 0xCBF29CE484222325;
+		for (size_t i = 0; i < file->size; i++) {
+			h ^= file->data[i];
+			h *= 0x100000001B3;
+		}
+
+		file->hash = h;
+		file->hashed = true;
+	}
+
+	return file->hash;
+}
@@ -0,0 +1,47 @@
+#ifndef FONT_H
+#define FONT_H
+
+#include <stdint.h>
+#include <SDL2/SDL_ttf.h>
+
+/*
+ * A font file mapped into memory once and shared by every TTF_Font opened
+ * from it, whatever their size or style and whichever thread uses them.
+ * The mapping lives until the file and every font opened from it are closed.
+ */
+typedef struct font_file font_file;
+
+/*
+ * Maps the font file at the path, returns NULL if it can't be read.
+ */
+font_file* font_file_load(const char* path);
+
+/*
+ * Drops the reference returned by font_file_load. Fonts still open keep the
+ * mapping alive until they are closed.
+ */
+void font_file_free(font_file* file);
+
+/*
+ * Opens a font at the point size straight from the mapping, without any more
+ * reading from disk. Each font holds a reference to the file.
+ */
+TTF_Font* font_file_open(font_file* file, int point_size);
+
+/*
+ * Closes a font opened from the file and drops its reference.
+ */
+void font_file_close(font_file* file, TTF_Font* font);
+
+/*
+ * Returns the path the file was loaded from.
+ */
+const char* font_file_path(font_file* file);
+
+/*
+ * Returns a 64 bit FNV-1a hash of the file contents, computed the first time
+ * it is asked for.
+ */
+uint64_t font_file_hash(font_file* file);
+
+#endif
@@ -1,205 +1,853 @@
 #include <stddef.h>
 #include <stdbool.h>
-#include <SDL2/SDL.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "glyph.h"
+#include "utf8.h"
 
 #define STB_DS_IMPLEMENTATION
 #include "stb_ds.h"
 
-static bool
-is_utf8_codepoint_start(const char ch)
+// Maximum number of glyphs stored in a single rope node
+#define GLYPH_CHUNK 128
+
+// Inserts of up to this many bytes, like the text of a keystroke, are decoded
+// on the stack rather than the heap
+#define GLYPH_STACK_RUN 32
+
+/*
+ * The glyph buffer is a rope: a treap of nodes ordered by position, where each
+ * node holds a chunk of up to GLYPH_CHUNK consecutive glyphs along with the
+ * glyph, byte, pixel width and newline totals of its whole subtree. A glyph's
+ * share of the width is its advance plus its kerning with the glyph after it.
+ * Positional and line lookups, inserts and removes descend the tree in
+ * O(log n), and edits inside a chunk only move the glyphs of that chunk.
+ */
+struct glyph_node {
+	glyph_node* left;
+	glyph_node* right;
+	uint32_t priority;
+
+	// Totals of the subtree rooted at this node
+	size_t count;
+	size_t bytes;
+	int64_t width;
+	size_t lines;
+
+	// This node's chunk of glyphs, kept as parallel arrays so layout passes
+	// only stream the advances through the cache
+	size_t len;
+	size_t chunk_bytes;
+	int64_t chunk_width;
+	size_t chunk_lines;
+	uint32_t codepoints[GLYPH_CHUNK];
+	int w[GLYPH_CHUNK];
+	int kern[GLYPH_CHUNK];
+	int h[GLYPH_CHUNK];
+};
+
+struct glyph_buffer {
+	glyph_node* root;
+};
+
+static glyph_measure_fn glyph_measure = NULL;
+static glyph_kern_fn glyph_kern = NULL;
+
+// xorshift32, seeded with a constant so tree shapes are reproducible
+static uint32_t glyph_seed = 2463534242u;
+
+static uint32_t
+glyph_random(void)
 {
-	//pkg.go.dev/unicode/utf8#RuneStart
-	return (ch & 0xC0) != 0x80;
+	glyph_seed ^= glyph_seed << 13;
+	glyph_seed ^= glyph_seed >> 17;
+	glyph_seed ^= glyph_seed << 5;
+	return glyph_seed;
 }
 
 static size_t
-utf8_codepoint_count(const char* str)
+glyph_node_count(glyph_node* t)
 {
-	if (str == NULL) {
-		return 0;
+	return t ? t->count : 0;
+}
+
+static size_t
+glyph_node_bytes(glyph_node* t)
+{
+	return t ? t->bytes : 0;
+}
+
+static int64_t
+glyph_node_width(glyph_node* t)
+{
+	return t ? t->width : 0;
+}
+
+static size_t
+glyph_node_lines(glyph_node* t)
+{
+	return t ? t->lines : 0;
+}
+
+static void
+glyph_node_update(glyph_node* t)
+{
+	t->count = glyph_node_count(t->left) + t->len + glyph_node_count(t->right);
+	t->bytes = glyph_node_bytes(t->left) + t->chunk_bytes + glyph_node_bytes(t->right);
+	t->width = glyph_node_width(t->left) + t->chunk_width + glyph_node_width(t->right);
+	t->lines = glyph_node_lines(t->left) + t->chunk_lines + glyph_node_lines(t->right);
+}
+
+static void
+glyph_chunk_update(glyph_node* t)
+{
+	t->chunk_bytes = 0;
+	t->chunk_width = 0;
+	t->chunk_lines = 0;
+	for (size_t i = 0; i < t->len; i++) {
+		t->chunk_bytes += utf8_encode(t->codepoints[i], NULL);
+		t->chunk_width += t->w[i] + t->kern[i];
+		t->chunk_lines += t->codepoints[i] == '\n';
 	}
+	glyph_node_update(t);
+}
+
+// Moves glyphs within a chunk, the ranges may overlap
+static void
+glyph_chunk_move(glyph_node* t, const size_t to, const size_t from, const size_t len)
+{
+	memmove(&t->codepoints[to], &t->codepoints[from], len * sizeof(uint32_t));
+	memmove(&t->w[to], &t->w[from], len * sizeof(int));
+	memmove(&t->kern[to], &t->kern[from], len * sizeof(int));
+	memmove(&t->h[to], &t->h[from], len * sizeof(int));
+}
 
-	int runes = 0;
-	size_t len = strlen(str);
+// Copies glyphs from one chunk into another
+static void
+glyph_chunk_copy(glyph_node* dest, const size_t to, const glyph_node* src, const size_t from, const size_t len)
+{
+	memcpy(&dest->codepoints[to], &src->codepoints[from], len * sizeof(uint32_t));
+	memcpy(&dest->w[to], &src->w[from], len * sizeof(int));
+	memcpy(&dest->kern[to], &src->kern[from], len * sizeof(int));
+	memcpy(&dest->h[to], &src->h[from], len * sizeof(int));
+}
+
+// Scatters a run of glyphs into the arrays of a chunk
+static void
+glyph_chunk_store(glyph_node* t, const size_t to, const glyph* run, const size_t len)
+{
 	for (size_t i = 0; i < len; i++) {
-		if (is_utf8_codepoint_start(str[i])) {
-			runes++;
+		t->codepoints[to + i] = run[i].codepoint;
+		t->w[to + i] = run[i].w;
+		t->kern[to + i] = run[i].kern;
+		t->h[to + i] = run[i].h;
+	}
+}
+
+static glyph_node*
+glyph_node_create(void)
+{
+	glyph_node* t = calloc(1, sizeof(glyph_node));
+	if (!t) {
+		return NULL;
+	}
+
+	t->priority = glyph_random();
+	glyph_node_update(t);
+
+	return t;
+}
+
+static void
+glyph_node_free(glyph_node* t)
+{
+	if (!t) {
+		return;
+	}
+
+	glyph_node_free(t->left);
+	glyph_node_free(t->right);
+	free(t);
+}
+
+static glyph_node*
+glyph_merge(glyph_node* l, glyph_node* r)
+{
+	if (!l) {
+		return r;
+	}
+
+	if (!r) {
+		return l;
+	}
+
+	if (l->priority > r->priority) {
+		l->right = glyph_merge(l->right, r);
+		glyph_node_update(l);
+		return l;
+	}
+
+	r->left = glyph_merge(l, r->left);
+	glyph_node_update(r);
+	return r;
+}
+
+/*
+ * Splits the tree so the first index glyphs end up in l and the rest in r,
+ * cutting the chunk the index falls inside of in two if needed. Returns false
+ * and leaves the tree as it was if the cut off chunk can't be allocated.
+ */
+static bool
+glyph_split(glyph_node* t, const size_t index, glyph_node** l, glyph_node** r)
+{
+	if (!t) {
+		*l = NULL;
+		*r = NULL;
+		return true;
+	}
+
+	size_t left_count = glyph_node_count(t->left);
+
+	if (index <= left_count) {
+		glyph_node* left_r = NULL;
+		if (!glyph_split(t->left, index, l, &left_r)) {
+			return false;
+		}
+		t->left = left_r;
+		glyph_node_update(t);
+		*r = t;
+	} else if (index >= left_count + t->len) {
+		glyph_node* right_l = NULL;
+		if (!glyph_split(t->right, index - left_count - t->len, &right_l, r)) {
+			return false;
+		}
+		t->right = right_l;
+		glyph_node_update(t);
+		*l = t;
+	} else {
+		// Move the tail of this chunk into a node of its own
+		size_t at = index - left_count;
+		glyph_node* tail = glyph_node_create();
+		glyph_node* right = t->right;
+		if (!tail) {
+			return false;
 		}
+
+		// The tail stands in for this node under its parent, so it can't
+		// outrank it
+		tail->priority = t->priority;
+		tail->len = t->len - at;
+		glyph_chunk_copy(tail, 0, t, at, tail->len);
+		glyph_chunk_update(tail);
+
+		t->right = NULL;
+		t->len = at;
+		glyph_chunk_update(t);
+
+		*l = t;
+		*r = glyph_merge(tail, right);
 	}
-	return runes;
+
+	return true;
 }
 
-size_t
-glyph_len(glyph* arr)
+static glyph_node*
+glyph_node_first(glyph_node* t)
 {
-	return arrlenu(arr);
+	while (t && t->left) {
+		t = t->left;
+	}
+	return t;
 }
 
-void
-glyph_free(glyph* arr)
+static glyph_node*
+glyph_node_last(glyph_node* t)
 {
-	if (!arr) {
+	while (t && t->right) {
+		t = t->right;
+	}
+	return t;
+}
+
+// Appends a chunk to the last chunk of the tree, which must have room for it
+static void
+glyph_append_last(glyph_node* t, const glyph_node* src)
+{
+	if (t->right) {
+		glyph_append_last(t->right, src);
+		glyph_node_update(t);
 		return;
 	}
 
-	for (size_t i = 0; i < glyph_len(arr); i++) {
-		if (arr[i].texture) {
-			SDL_DestroyTexture(arr[i].texture);
+	glyph_chunk_copy(t, t->len, src, 0, src->len);
+	t->len += src->len;
+	glyph_chunk_update(t);
+}
+
+/*
+ * Merges two trees, folding the chunks either side of the seam together when
+ * they fit in one so edits don't leave a trail of tiny chunks behind.
+ */
+static glyph_node*
+glyph_join(glyph_node* l, glyph_node* r)
+{
+	glyph_node* last = glyph_node_last(l);
+	glyph_node* first = glyph_node_first(r);
+
+	glyph_node* head = NULL;
+	if (last && first && last->len + first->len <= GLYPH_CHUNK && glyph_split(r, first->len, &head, &r)) {
+		glyph_append_last(l, head);
+		glyph_node_free(head);
+	}
+
+	return glyph_merge(l, r);
+}
+
+// Inserts glyphs into the chunk holding the index if it has room for them
+static bool
+glyph_node_insert(glyph_node* t, const size_t index, const glyph* glyphs, const size_t len)
+{
+	if (!t) {
+		return false;
+	}
+
+	size_t left_count = glyph_node_count(t->left);
+	bool inserted = false;
+
+	if (index < left_count) {
+		inserted = glyph_node_insert(t->left, index, glyphs, len);
+	} else if (index <= left_count + t->len) {
+		if (t->len + len > GLYPH_CHUNK) {
+			return false;
+		}
+
+		size_t at = index - left_count;
+		glyph_chunk_move(t, at + len, at, t->len - at);
+		glyph_chunk_store(t, at, glyphs, len);
+		t->len += len;
+		for (size_t i = 0; i < len; i++) {
+			t->chunk_bytes += utf8_encode(glyphs[i].codepoint, NULL);
+			t->chunk_width += glyphs[i].w + glyphs[i].kern;
+			t->chunk_lines += glyphs[i].codepoint == '\n';
 		}
+		inserted = true;
+	} else {
+		inserted = glyph_node_insert(t->right, index - left_count - t->len, glyphs, len);
 	}
 
-	arrfree(arr);
+	if (inserted) {
+		glyph_node_update(t);
+	}
+
+	return inserted;
 }
 
-char*
-glyph_to_string(glyph* arr)
+// Splices a run of glyphs into the buffer at the index in a single edit,
+// returns false and leaves the buffer as it was if out of memory
+static bool
+glyph_put_run(glyph_buffer* buf, const size_t index, const glyph* run, const size_t len)
 {
-	if (glyph_len(arr) < 1) {
-		return NULL;
+	if (glyph_node_insert(buf->root, index, run, len)) {
+		return true;
 	}
 
-	char* out = calloc(glyph_len(arr) + 1, sizeof(char));
-	size_t pos = 0;
+	// Too big for the chunk, so chop the run into nodes of its own
+	glyph_node* middle = NULL;
+	for (size_t i = 0; i < len; i += GLYPH_CHUNK) {
+		size_t chunk = len - i < GLYPH_CHUNK ? len - i : GLYPH_CHUNK;
+		glyph_node* t = glyph_node_create();
+		if (!t) {
+			glyph_node_free(middle);
+			return false;
+		}
+
+		t->len = chunk;
+		glyph_chunk_store(t, 0, &run[i], chunk);
+		glyph_chunk_update(t);
+		middle = glyph_merge(middle, t);
+	}
+
+	glyph_node* l = NULL;
+	glyph_node* r = NULL;
+	if (!glyph_split(buf->root, index, &l, &r)) {
+		glyph_node_free(middle);
+		return false;
+	}
+
+	buf->root = glyph_join(glyph_join(l, middle), r);
+	return true;
+}
+
+// Sets the kerning of the glyph at the index with the one after it
+static void
+glyph_node_set_kern(glyph_node* t, size_t index, int kern)
+{
+	size_t left_count = glyph_node_count(t->left);
+	if (index < left_count) {
+		glyph_node_set_kern(t->left, index, kern);
+	} else if (index < left_count + t->len) {
+		size_t i = index - left_count;
+		t->chunk_width += kern - t->kern[i];
+		t->kern[i] = kern;
+	} else {
+		glyph_node_set_kern(t->right, index - left_count - t->len, kern);
+	}
+
+	glyph_node_update(t);
+}
 
-	for (size_t g = 0; g < glyph_len(arr); g++) {
-		size_t bytes = strlen(arr[g].utf8);
-		for (size_t b = 0; b < bytes; b++) {
-			out[pos++] = arr[g].utf8[b];
+// Kerns the glyphs either side of the index again after an edit brought them
+// together, the last glyph has nothing to kern with
+static void
+glyph_kern_seam(glyph_buffer* buf, size_t index)
+{
+	size_t len = glyph_len(buf);
+	if (!glyph_kern || index == 0 || index > len) {
+		return;
+	}
+
+	glyph prev = glyph_get(buf, index - 1);
+	int kern = index < len ? glyph_kern(prev.codepoint, glyph_get(buf, index).codepoint) : 0;
+	if (kern != prev.kern) {
+		glyph_node_set_kern(buf->root, index - 1, kern);
+	}
+}
+
+void
+glyph_set_measure(glyph_measure_fn measure)
+{
+	glyph_measure = measure;
+}
+
+void
+glyph_set_kern(glyph_kern_fn kern)
+{
+	glyph_kern = kern;
+}
+
+size_t
+glyph_len(glyph_buffer* buf)
+{
+	if (!buf) {
+		return 0;
+	}
+
+	return glyph_node_count(buf->root);
+}
+
+glyph
+glyph_get(glyph_buffer* buf, size_t index)
+{
+	if (index >= glyph_len(buf)) {
+		return EMPTY_GLYPH;
+	}
+
+	glyph_node* t = buf->root;
+	while (t) {
+		size_t left_count = glyph_node_count(t->left);
+		if (index < left_count) {
+			t = t->left;
+		} else if (index < left_count + t->len) {
+			size_t i = index - left_count;
+			return (glyph){
+				.codepoint = t->codepoints[i],
+				.w = t->w[i],
+				.kern = t->kern[i],
+				.h = t->h[i],
+			};
+		} else {
+			index -= left_count + t->len;
+			t = t->right;
 		}
 	}
 
-	return out;
+	return EMPTY_GLYPH;
 }
 
-glyph*
-glyph_append(glyph* arr, const char* utf8_str)
+size_t
+glyph_byte_offset(glyph_buffer* buf, size_t index)
 {
-	size_t len_bytes = 0;
-	bool inside_rune = false;
-	size_t start = 0;
-	size_t end = 0;
+	if (index >= glyph_len(buf)) {
+		return buf ? glyph_node_bytes(buf->root) : 0;
+	}
 
-	if (!utf8_str) {
-		return arr;
+	size_t bytes = 0;
+	glyph_node* t = buf->root;
+	while (t) {
+		size_t left_count = glyph_node_count(t->left);
+		if (index < left_count) {
+			t = t->left;
+		} else if (index < left_count + t->len) {
+			bytes += glyph_node_bytes(t->left);
+			for (size_t i = 0; i < index - left_count; i++) {
+				bytes += utf8_encode(t->codepoints[i], NULL);
+			}
+			break;
+		} else {
+			bytes += glyph_node_bytes(t->left) + t->chunk_bytes;
+			index -= left_count + t->len;
+			t = t->right;
+		}
+	}
+
+	return bytes;
+}
+
+int64_t
+glyph_x_offset(glyph_buffer* buf, size_t index)
+{
+	if (index >= glyph_len(buf)) {
+		return buf ? glyph_node_width(buf->root) : 0;
+	}
+
+	int64_t x = 0;
+	glyph_node* t = buf->root;
+	while (t) {
+		size_t left_count = glyph_node_count(t->left);
+		if (index < left_count) {
+			t = t->left;
+		} else if (index < left_count + t->len) {
+			x += glyph_node_width(t->left);
+			for (size_t i = 0; i < index - left_count; i++) {
+				x += t->w[i] + t->kern[i];
+			}
+			break;
+		} else {
+			x += glyph_node_width(t->left) + t->chunk_width;
+			index -= left_count + t->len;
+			t = t->right;
+		}
+	}
+
+	return x;
+}
+
+size_t
+glyph_index_at_x(glyph_buffer* buf, int64_t x)
+{
+	if (x <= 0 || glyph_len(buf) == 0) {
+		return 0;
 	}
 
-	len_bytes = strlen(utf8_str);
-	if (len_bytes == 0) {
-		return arr;
+	if (x >= glyph_node_width(buf->root)) {
+		return glyph_len(buf);
 	}
 
-	if (utf8_codepoint_count(utf8_str) == 0) {
-		return arr;
+	// Binary search down the width totals for the glyph under x
+	size_t index = 0;
+	glyph_node* t = buf->root;
+	while (t) {
+		int64_t left_width = glyph_node_width(t->left);
+		if (x < left_width) {
+			t = t->left;
+		} else if (x < left_width + t->chunk_width) {
+			index += glyph_node_count(t->left);
+			x -= left_width;
+			for (size_t i = 0; i < t->len; i++) {
+				// Round to whichever edge of the glyph is closer
+				int advance = t->w[i] + t->kern[i];
+				if (2 * x < advance) {
+					return index + i;
+				}
+				x -= advance;
+				if (x < 0) {
+					return index + i + 1;
+				}
+			}
+			return index + t->len;
+		} else {
+			index += glyph_node_count(t->left) + t->len;
+			x -= left_width + t->chunk_width;
+			t = t->right;
+		}
 	}
 
-	for (size_t b = 0; b < len_bytes; b++) {
-		if (is_utf8_codepoint_start(utf8_str[b])) {
-			if (inside_rune) {
-				end = b - 1;
+	return index;
+}
 
-				glyph g = EMPTY_GLYPH;
-				for (size_t i = start; i <= end; i++) {
-					g.utf8[i - start] = utf8_str[i];
+size_t
+glyph_line_count(glyph_buffer* buf)
+{
+	return (buf ? glyph_node_lines(buf->root) : 0) + 1;
+}
+
+size_t
+glyph_line_start(glyph_buffer* buf, size_t line)
+{
+	if (line == 0) {
+		return 0;
+	}
+
+	if (line >= glyph_line_count(buf)) {
+		return glyph_len(buf);
+	}
+
+	// Find the newline ending the previous line, the line starts right after it
+	size_t index = 0;
+	glyph_node* t = buf->root;
+	while (t) {
+		size_t left_lines = glyph_node_lines(t->left);
+		if (line <= left_lines) {
+			t = t->left;
+		} else if (line <= left_lines + t->chunk_lines) {
+			index += glyph_node_count(t->left);
+			line -= left_lines;
+			for (size_t i = 0; i < t->len; i++) {
+				if (t->codepoints[i] == '\n' && --line == 0) {
+					return index + i + 1;
 				}
-				arrput(arr, g);
+			}
+			break;
+		} else {
+			index += glyph_node_count(t->left) + t->len;
+			line -= left_lines + t->chunk_lines;
+			t = t->right;
+		}
+	}
+
+	return index;
+}
+
+size_t
+glyph_line_of(glyph_buffer* buf, size_t index)
+{
+	if (index >= glyph_len(buf)) {
+		return buf ? glyph_node_lines(buf->root) : 0;
+	}
 
-				start = b;
-			} else {
-				start = b;
-				inside_rune = true;
+	size_t line = 0;
+	glyph_node* t = buf->root;
+	while (t) {
+		size_t left_count = glyph_node_count(t->left);
+		if (index < left_count) {
+			t = t->left;
+		} else if (index < left_count + t->len) {
+			line += glyph_node_lines(t->left);
+			for (size_t i = 0; i < index - left_count; i++) {
+				line += t->codepoints[i] == '\n';
 			}
+			break;
+		} else {
+			line += glyph_node_lines(t->left) + t->chunk_lines;
+			index -= left_count + t->len;
+			t = t->right;
 		}
 	}
 
-	end = len_bytes - 1;
+	return line;
+}
+
+glyph_iter
+glyph_iter_at(glyph_buffer* buf, size_t index)
+{
+	glyph_iter it = { .stack = NULL, .offset = 0 };
+	if (index >= glyph_len(buf)) {
+		return it;
+	}
 
-	glyph g = EMPTY_GLYPH;
-	for (size_t i = start; i <= end; i++) {
-		g.utf8[i - start] = utf8_str[i];
+	// Stack up every node still to be visited on the way down to the index
+	glyph_node* t = buf->root;
+	while (t) {
+		size_t left_count = glyph_node_count(t->left);
+		if (index < left_count) {
+			arrput(it.stack, t);
+			t = t->left;
+		} else if (index < left_count + t->len) {
+			arrput(it.stack, t);
+			it.offset = index - left_count;
+			break;
+		} else {
+			index -= left_count + t->len;
+			t = t->right;
+		}
 	}
-	arrput(arr, g);
 
-	return arr;
+	return it;
 }
 
-glyph*
-glyph_insert(glyph* arr, const size_t index, const char* utf8_str)
+bool
+glyph_iter_next(glyph_iter* it, glyph_span* span)
 {
-	size_t len_bytes = 0;
-	size_t current_rune = 0;
-	bool inside_rune = false;
-	size_t start = 0;
-	size_t end = 0;
+	if (arrlenu(it->stack) == 0) {
+		glyph_iter_free(it);
+		return false;
+	}
+
+	glyph_node* t = arrpop(it->stack);
+	span->codepoints = &t->codepoints[it->offset];
+	span->w = &t->w[it->offset];
+	span->kern = &t->kern[it->offset];
+	span->h = &t->h[it->offset];
+	span->len = t->len - it->offset;
+	it->offset = 0;
+
+	for (glyph_node* n = t->right; n; n = n->left) {
+		arrput(it->stack, n);
+	}
+
+	return true;
+}
+
+void
+glyph_iter_free(glyph_iter* it)
+{
+	arrfree(it->stack);
+	it->stack = NULL;
+}
+
+void
+glyph_free(glyph_buffer* buf)
+{
+	if (!buf) {
+		return;
+	}
+
+	glyph_node_free(buf->root);
+	free(buf);
+}
+
+char*
+glyph_to_string(glyph_buffer* buf)
+{
+	if (glyph_len(buf) < 1) {
+		return NULL;
+	}
+
+	char* out = calloc(glyph_node_bytes(buf->root) + 1, sizeof(char));
+	size_t pos = 0;
 
-	if (index > arrlenu(arr)) {
-		return glyph_append(arr, utf8_str);
+	glyph_iter it = glyph_iter_at(buf, 0);
+	glyph_span span;
+	while (glyph_iter_next(&it, &span)) {
+		for (size_t g = 0; g < span.len; g++) {
+			pos += utf8_encode(span.codepoints[g], &out[pos]);
+		}
 	}
 
+	return out;
+}
+
+glyph_buffer*
+glyph_append(glyph_buffer* buf, const char* utf8_str)
+{
+	return glyph_insert(buf, glyph_len(buf), utf8_str);
+}
+
+glyph_buffer*
+glyph_insert(glyph_buffer* buf, size_t index, const char* utf8_str)
+{
 	if (!utf8_str) {
-		return arr;
+		return buf;
 	}
 
-	len_bytes = strlen(utf8_str);
-	if (len_bytes == 0) {
-		return arr;
+	return glyph_insert_n(buf, index, utf8_str, strlen(utf8_str));
+}
+
+glyph_buffer*
+glyph_insert_n(glyph_buffer* buf, size_t index, const char* utf8_str, size_t len_bytes)
+{
+	if (!utf8_str || len_bytes == 0) {
+		return buf;
 	}
 
-	if (utf8_codepoint_count(utf8_str) == 0) {
-		return arr;
+	if (!buf) {
+		buf = calloc(1, sizeof(glyph_buffer));
+		if (!buf) {
+			return NULL;
+		}
 	}
 
-	for (size_t b = 0; b < len_bytes; b++) {
-		if (is_utf8_codepoint_start(utf8_str[b])) {
-			if (inside_rune) {
-				end = b - 1;
+	if (index > glyph_len(buf)) {
+		index = glyph_len(buf);
+	}
 
-				glyph g = EMPTY_GLYPH;
-				for (size_t i = start; i <= end; i++) {
-					g.utf8[i - start] = utf8_str[i];
-				}
-				arrins(arr, index + current_rune, g);
+	// Decode the whole string first so it goes into the rope in one splice,
+	// a rune is at least a byte so there are never more runes than bytes
+	uint32_t stack_codepoints[GLYPH_STACK_RUN];
+	glyph stack_run[GLYPH_STACK_RUN];
+	uint32_t* codepoints = stack_codepoints;
+	glyph* run = stack_run;
+	bool on_heap = len_bytes > GLYPH_STACK_RUN;
+
+	if (on_heap) {
+		codepoints = malloc(len_bytes * sizeof(uint32_t));
+		run = malloc(len_bytes * sizeof(glyph));
+		if (!codepoints || !run) {
+			free(codepoints);
+			free(run);
+			return buf;
+		}
+	}
 
-				current_rune++;
-				start = b;
-			} else {
-				start = b;
-				inside_rune = true;
-			}
+	size_t runes = utf8_decode_n(utf8_str, len_bytes, codepoints);
+
+	for (size_t i = 0; i < runes; i++) {
+		run[i] = EMPTY_GLYPH;
+		run[i].codepoint = codepoints[i];
+	}
+
+	if (glyph_measure) {
+		for (size_t i = 0; i < runes; i++) {
+			glyph_measure(&run[i]);
 		}
+	}
 
+	if (glyph_kern) {
+		for (size_t i = 0; i + 1 < runes; i++) {
+			run[i].kern = glyph_kern(run[i].codepoint, run[i + 1].codepoint);
+		}
 	}
 
-	end = len_bytes - 1;
+	bool put = glyph_put_run(buf, index, run, runes);
+	if (on_heap) {
+		free(codepoints);
+		free(run);
+	}
 
-	glyph g = EMPTY_GLYPH;
-	for (size_t i = start; i <= end; i++) {
-		g.utf8[i - start] = utf8_str[i];
+	if (!put) {
+		return buf;
 	}
-	arrins(arr, index + current_rune, g);
 
-	return arr;
+	// The run now sits between two glyphs that used to kern with each other
+	glyph_kern_seam(buf, index);
+	glyph_kern_seam(buf, index + runes);
+
+	return buf;
 }
 
-glyph*
-glyph_remove(glyph* arr, const size_t index, const size_t count)
+glyph_buffer*
+glyph_remove(glyph_buffer* buf, const size_t index, size_t count)
 {
 	if (count < 1) {
-		return arr;
+		return buf;
 	}
 
-	if (index < 0 || index > arrlenu(arr) - 1) {
-		return arr;
+	if (index >= glyph_len(buf)) {
+		return buf;
 	}
 
-	for (size_t i = index; i < (index + count); i++) {
-		if (arr[i].texture) {
-			SDL_DestroyTexture(arr[i].texture);
-		}
+	if (count > glyph_len(buf) - index) {
+		count = glyph_len(buf) - index;
+	}
+
+	// Cut the removed glyphs out of the rope and stitch the ends back together
+	glyph_node* l = NULL;
+	glyph_node* mid = NULL;
+	glyph_node* r = NULL;
+	if (!glyph_split(buf->root, index, &l, &mid)) {
+		return buf;
+	}
+
+	if (!glyph_split(mid, count, &mid, &r)) {
+		buf->root = glyph_join(l, mid);
+		return buf;
 	}
 
-	arrdeln(arr, index, count);
+	glyph_node_free(mid);
+	buf->root = glyph_join(l, r);
+	glyph_kern_seam(buf, index);
 
-	return arr;
+	return buf;
 }
@@ -1,51 +1,173 @@
+#ifndef GLYPH_H
+#define GLYPH_H
+
+#include <stdbool.h>
 #include <stddef.h>
-#include <SDL2/SDL.h>
+#include <stdint.h>
 
 typedef struct {
-	char utf8[5];
+	uint32_t codepoint;
 	int w;
+	int kern;
 	int h;
-	SDL_Texture* texture;
 } glyph;
 
 #define EMPTY_GLYPH (glyph){                  \
-	.utf8 = { '\0', '\0', '\0', '\0', '\0',}, \
+	.codepoint = 0,                           \
 	.w = 0,                                   \
+	.kern = 0,                                \
 	.h = 0,                                   \
-	.texture = NULL,                          \
 }                                             \
 
 /*
- * Returns the number of glyphs in the glyph array.
+ * Rope of glyphs. A NULL pointer is a valid empty buffer.
+ */
+typedef struct glyph_buffer glyph_buffer;
+
+typedef struct glyph_node glyph_node;
+
+/*
+ * A run of consecutive glyphs stored together in the glyph buffer, as
+ * parallel arrays of each glyph field.
+ */
+typedef struct {
+	const uint32_t* codepoints;
+	const int* w;
+	const int* kern;
+	const int* h;
+	size_t len;
+} glyph_span;
+
+/*
+ * In-order iterator over the spans of a glyph buffer.
+ */
+typedef struct {
+	glyph_node** stack;
+	size_t offset;
+} glyph_iter;
+
+/*
+ * Function called on every glyph added to a glyph buffer to fill in its
+ * advance and height.
+ */
+typedef void (*glyph_measure_fn)(glyph* g);
+
+/*
+ * Sets the function used to measure glyphs as they are added.
+ */
+void glyph_set_measure(glyph_measure_fn measure);
+
+/*
+ * Function called on each pair of neighbouring glyphs in a glyph buffer to get
+ * the kerning in pixels between them.
  */
-size_t glyph_len(glyph* arr);
+typedef int (*glyph_kern_fn)(uint32_t left, uint32_t right);
 
 /*
- * Frees the glyph array, including the glyph textures.
+ * Sets the function used to kern glyphs as they are added. Each glyph keeps
+ * its kerning with the glyph after it, which counts towards its x offset, and
+ * is only kerned again when an edit gives it a new neighbour.
  */
-void glyph_free(glyph* arr);
+void glyph_set_kern(glyph_kern_fn kern);
 
 /*
- * Returns a malloc'd string of UTF-8 encoded text that the glyph array
+ * Returns the number of glyphs in the glyph buffer.
+ */
+size_t glyph_len(glyph_buffer* buf);
+
+/*
+ * Returns a copy of the glyph at the given index, or EMPTY_GLYPH if the index
+ * is out of range.
+ */
+glyph glyph_get(glyph_buffer* buf, size_t index);
+
+/*
+ * Returns the offset in bytes of the glyph at the given index in the UTF-8
+ * text the glyph buffer represents.
+ */
+size_t glyph_byte_offset(glyph_buffer* buf, size_t index);
+
+/*
+ * Returns the x offset in pixels of the glyph at the given index from the
+ * start of the glyph buffer, including the kerning of the glyphs before it.
+ */
+int64_t glyph_x_offset(glyph_buffer* buf, size_t index);
+
+/*
+ * Returns the index of the glyph boundary closest to the given x offset in
+ * pixels from the start of the glyph buffer.
+ */
+size_t glyph_index_at_x(glyph_buffer* buf, int64_t x);
+
+/*
+ * Returns the number of lines in the glyph buffer, which is one more than the
+ * number of newline glyphs.
+ */
+size_t glyph_line_count(glyph_buffer* buf);
+
+/*
+ * Returns the index of the first glyph of the given line, or the length of the
+ * glyph buffer if the line is out of range.
+ */
+size_t glyph_line_start(glyph_buffer* buf, size_t line);
+
+/*
+ * Returns the line the glyph at the given index is on.
+ */
+size_t glyph_line_of(glyph_buffer* buf, size_t index);
+
+/*
+ * Returns an iterator over the glyphs from the given index to the end.
+ * The iterator is invalidated by the next edit of the buffer.
+ */
+glyph_iter glyph_iter_at(glyph_buffer* buf, size_t index);
+
+/*
+ * Gets the next span of glyphs from the iterator.
+ * Returns false and frees the iterator once there are no more glyphs.
+ */
+bool glyph_iter_next(glyph_iter* it, glyph_span* span);
+
+/*
+ * Frees an iterator that is abandoned before reaching the end.
+ */
+void glyph_iter_free(glyph_iter* it);
+
+/*
+ * Frees the glyph buffer.
+ */
+void glyph_free(glyph_buffer* buf);
+
+/*
+ * Returns a malloc'd string of UTF-8 encoded text that the glyph buffer
  * represents.
  */
-char* glyph_to_string(glyph* arr);
+char* glyph_to_string(glyph_buffer* buf);
 
 /*
- * Append a UTF-8 encoded string to the glyph array.
- * Returns an updated pointer to the glyph array.
+ * Append a UTF-8 encoded string to the glyph buffer.
+ * Returns an updated pointer to the glyph buffer.
  */
-glyph* glyph_append(glyph* arr, const char* utf8_str);
+glyph_buffer* glyph_append(glyph_buffer* buf, const char* utf8_str);
 
 /*
- * Inserts a UTF-8 encoded string to the glyph array at the given index.
- * Returns an updated pointer to the glyph array.
+ * Inserts a UTF-8 encoded string to the glyph buffer at the given index.
+ * Returns an updated pointer to the glyph buffer.
  */
-glyph* glyph_insert(glyph* arr, const size_t index, const char* utf8_str);
+glyph_buffer* glyph_insert(glyph_buffer* buf, size_t index, const char* utf8_str);
 
 /*
- * Removes a the given count of glyphs from the glyph array starting from the
+ * Inserts the first len_bytes of a UTF-8 encoded string to the glyph buffer
+ * at the given index. The string does not need to be null terminated.
+ * Returns an updated pointer to the glyph buffer.
+ */
+glyph_buffer* glyph_insert_n(glyph_buffer* buf, size_t index, const char* utf8_str, size_t len_bytes);
+
+/*
+ * Removes a the given count of glyphs from the glyph buffer starting from the
  * given index.
- * Returns an updated pointer to the glyph array.
+ * Returns an updated pointer to the glyph buffer.
  */
-glyph* glyph_remove(glyph* arr, const size_t index, const size_t count);
+glyph_buffer* glyph_remove(glyph_buffer* buf, const size_t index, size_t count);
+
+#endif
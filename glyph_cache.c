@@ -0,0 +1,875 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+#include "font.h"
+#include "glyph_cache.h"
+#include "utf8.h"
+
+// The stb_ds hashmap macros use typeof, which -std=c99 only has spelled as
+// the GNU keyword
+#define typeof __typeof__
+#include "stb_ds.h"
+
+// Gap left between packed glyphs so filtering never bleeds a neighbour in
+#define GLYPH_CACHE_PADDING 1
+
+// Most threads rasterizing glyphs in the background
+#define GLYPH_CACHE_MAX_WORKERS 4
+
+// Atlas files start with "SDLA" and are thrown away on a version mismatch
+#define GLYPH_CACHE_FILE_MAGIC 0x414C4453
+#define GLYPH_CACHE_FILE_VERSION 2
+#define GLYPH_CACHE_FILE_ALIGN 4096
+
+#define GLYPH_CACHE_PAGE_BYTES ((size_t) GLYPH_CACHE_PAGE_SIZE * GLYPH_CACHE_PAGE_SIZE * 4)
+
+// Advances are kept in blocks of this many consecutive codepoints, each only
+// allocated once one of its codepoints is measured
+#define GLYPH_CACHE_ADVANCE_BLOCK 256
+#define GLYPH_CACHE_ADVANCE_BLOCKS (0x110000 / GLYPH_CACHE_ADVANCE_BLOCK)
+#define GLYPH_CACHE_ADVANCE_UNKNOWN INT16_MIN
+
+typedef struct {
+	uint32_t codepoint;
+
+	// Page -1 until the glyph is rasterized, or if that failed
+	int page;
+	SDL_Rect rect;
+
+	bool prewarm;
+	bool ready;
+} glyph_cache_entry;
+
+typedef struct {
+	int handle;
+	uint32_t codepoint;
+} glyph_cache_job;
+
+typedef struct {
+	glyph_cache_job* jobs;
+	size_t next;
+} glyph_cache_queue;
+
+typedef struct {
+	int handle;
+
+	// Glyph rasterized into ARGB8888, NULL if it failed
+	SDL_Surface* surface;
+} glyph_cache_result;
+
+typedef struct {
+	glyph_cache* cache;
+	SDL_Thread* thread;
+
+	// SDL_ttf fonts can't be shared between threads, so each has its own
+	TTF_Font* font;
+} glyph_cache_worker;
+
+typedef struct {
+	uint32_t key;
+	int value;
+} glyph_cache_index;
+
+// Kerning of a pair of codepoints, keyed by the left one shifted above the right
+typedef struct {
+	uint64_t key;
+	int value;
+} glyph_cache_kern;
+
+// Everything a cached atlas was rendered with, it's only reused if they all match
+typedef struct {
+	uint64_t font_hash;
+	int32_t point_size;
+	int32_t style;
+	int32_t outline;
+	int32_t hinting;
+} glyph_cache_key;
+
+/*
+ * Atlas files are the header, then the entries, then the ARGB8888 pixels of
+ * every page starting at the next GLYPH_CACHE_FILE_ALIGN boundary so each
+ * page can be uploaded straight out of the mapping. They are only ever read
+ * back on the machine that wrote them, so everything is in native byte order.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	glyph_cache_key key;
+	int32_t page_size;
+	int32_t page_count;
+	int32_t entry_count;
+	int32_t shelf_x;
+	int32_t shelf_y;
+	int32_t shelf_h;
+} glyph_cache_file_header;
+
+typedef struct {
+	uint32_t codepoint;
+	int32_t page;
+	int32_t x;
+	int32_t y;
+	int32_t rect_w;
+	int32_t rect_h;
+} glyph_cache_file_entry;
+
+struct glyph_cache {
+	SDL_Renderer* renderer;
+	TTF_Font* font;
+	font_file* file;
+
+	// Atlas pages, glyphs are packed left to right in shelves down the last page
+	SDL_Texture** pages;
+
+	// CPU copies of the pages to save them from, the loaded ones live in a
+	// private mapping of the atlas file and the rest are allocated
+	uint32_t** shadows;
+	void* mapping;
+	size_t mapping_len;
+	int mapped_pages;
+
+	int shelf_x;
+	int shelf_y;
+	int shelf_h;
+
+	glyph_cache_entry* entries;
+	glyph_cache_index* index;
+	glyph_cache_kern* kerning;
+
+	// Metrics for layout, separate from the entries so measuring a glyph
+	// never rasterizes it
+	int16_t* advances[GLYPH_CACHE_ADVANCE_BLOCKS];
+	int height;
+
+	// Workers take jobs and hand back results, both guarded by the lock.
+	// Prewarm jobs are only taken once nothing is waiting to be drawn.
+	glyph_cache_worker workers[GLYPH_CACHE_MAX_WORKERS];
+	int worker_count;
+	SDL_mutex* lock;
+	SDL_cond* wake;
+	glyph_cache_queue jobs;
+	glyph_cache_queue prewarm;
+	glyph_cache_result* results;
+	bool quit;
+
+	// Pushed to wake the main thread when results are waiting
+	Uint32 event;
+
+	// Where the atlas is saved, NULL if it can't be. Only saved if it
+	// gained glyphs since it was loaded.
+	char* file_path;
+	glyph_cache_key key;
+	bool dirty;
+};
+
+// Glyphs are rasterized white and tinted with a color mod when drawn, so one
+// atlas entry serves every text color
+static const SDL_Color opaque_white = { 255, 255, 255, 255 };
+
+static bool
+glyph_cache_pack(glyph_cache* cache, int w, int h, int* page, SDL_Rect* rect)
+{
+	if (w + GLYPH_CACHE_PADDING > GLYPH_CACHE_PAGE_SIZE || h + GLYPH_CACHE_PADDING > GLYPH_CACHE_PAGE_SIZE) {
+		return false;
+	}
+
+	bool new_page = arrlenu(cache->pages) == 0;
+
+	// Start a new shelf when the glyph doesn't fit on the end of this one
+	if (!new_page && cache->shelf_x + w > GLYPH_CACHE_PAGE_SIZE) {
+		cache->shelf_x = 0;
+		cache->shelf_y += cache->shelf_h;
+		cache->shelf_h = 0;
+	}
+
+	if (!new_page && cache->shelf_y + h > GLYPH_CACHE_PAGE_SIZE) {
+		new_page = true;
+	}
+
+	if (new_page) {
+		SDL_Texture* texture = SDL_CreateTexture(cache->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, GLYPH_CACHE_PAGE_SIZE, GLYPH_CACHE_PAGE_SIZE);
+		if (!texture) {
+			SDL_Log("Error creating glyph atlas page: %s\n", SDL_GetError());
+			return false;
+		}
+
+		uint32_t* shadow = calloc(1, GLYPH_CACHE_PAGE_BYTES);
+		if (!shadow) {
+			SDL_DestroyTexture(texture);
+			return false;
+		}
+
+		SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+		arrput(cache->pages, texture);
+		arrput(cache->shadows, shadow);
+
+		cache->shelf_x = 0;
+		cache->shelf_y = 0;
+		cache->shelf_h = 0;
+	}
+
+	*page = arrlen(cache->pages) - 1;
+	*rect = (SDL_Rect){ .x = cache->shelf_x, .y = cache->shelf_y, .w = w, .h = h };
+
+	cache->shelf_x += w + GLYPH_CACHE_PADDING;
+	if (h + GLYPH_CACHE_PADDING > cache->shelf_h) {
+		cache->shelf_h = h + GLYPH_CACHE_PADDING;
+	}
+
+	return true;
+}
+
+// Renders the codepoint with the font into a surface ready to upload
+static SDL_Surface*
+glyph_cache_render(TTF_Font* font, uint32_t codepoint)
+{
+	char utf8[5] = { '\0', '\0', '\0', '\0', '\0' };
+	utf8_encode(codepoint, utf8);
+
+	SDL_Surface* rendered = TTF_RenderUTF8_Solid(font, utf8, opaque_white);
+	if (!rendered) {
+		SDL_Log("Error rendering glyph U+%04X: %s\n", codepoint, TTF_GetError());
+		return NULL;
+	}
+
+	// Convert from the palettized surface so the colorkey becomes alpha
+	SDL_Surface* converted = SDL_ConvertSurfaceFormat(rendered, SDL_PIXELFORMAT_ARGB8888, 0);
+	SDL_FreeSurface(rendered);
+
+	return converted;
+}
+
+// Packs the rendered glyph into the atlas and uploads it
+static void
+glyph_cache_place(glyph_cache* cache, glyph_cache_entry* entry, SDL_Surface* surface)
+{
+	// Failed glyphs are saved too, so they aren't retried next time either
+	cache->dirty = true;
+
+	if (!surface || !glyph_cache_pack(cache, surface->w, surface->h, &entry->page, &entry->rect)) {
+		return;
+	}
+
+	SDL_UpdateTexture(cache->pages[entry->page], &entry->rect, surface->pixels, surface->pitch);
+
+	uint32_t* shadow = cache->shadows[entry->page];
+	for (int y = 0; y < entry->rect.h; y++) {
+		const uint8_t* row = (const uint8_t*) surface->pixels + (size_t) y * surface->pitch;
+		memcpy(&shadow[(size_t) (entry->rect.y + y) * GLYPH_CACHE_PAGE_SIZE + entry->rect.x], row, (size_t) entry->rect.w * 4);
+	}
+}
+
+// Builds the atlas file path under the user cache directory, creating it
+static char*
+glyph_cache_file_path(const glyph_cache_key* key)
+{
+	const char* base = getenv("XDG_CACHE_HOME");
+	const char* suffix = "";
+	if (!base || !base[0]) {
+		base = getenv("HOME");
+		suffix = "/.cache";
+	}
+
+	if (!base || !base[0]) {
+		return NULL;
+	}
+
+	char dir[4096];
+	int dir_len = snprintf(dir, sizeof(dir), "%s%s", base, suffix);
+	if (dir_len < 0 || (size_t) dir_len >= sizeof(dir)) {
+		return NULL;
+	}
+	mkdir(dir, 0755);
+
+	if (snprintf(dir + dir_len, sizeof(dir) - dir_len, "/sdl-text-test") >= (int) (sizeof(dir) - dir_len)) {
+		return NULL;
+	}
+	mkdir(dir, 0755);
+
+	char name[128];
+	snprintf(name, sizeof(name), "/%016" PRIx64 "-%d-solid-%d-%d-%d.atlas", key->font_hash, key->point_size, key->style, key->outline, key->hinting);
+
+	char* path = malloc(strlen(dir) + strlen(name) + 1);
+	if (path) {
+		strcpy(path, dir);
+		strcat(path, name);
+	}
+
+	return path;
+}
+
+static size_t
+glyph_cache_file_pages_offset(size_t entry_count)
+{
+	size_t offset = sizeof(glyph_cache_file_header) + entry_count * sizeof(glyph_cache_file_entry);
+	return (offset + GLYPH_CACHE_FILE_ALIGN - 1) / GLYPH_CACHE_FILE_ALIGN * GLYPH_CACHE_FILE_ALIGN;
+}
+
+/*
+ * Maps the atlas file and uploads each of its pages in one go. Its glyphs are
+ * ready straight away, without going near FreeType. Any file that doesn't
+ * match the font and settings exactly is ignored.
+ */
+static void
+glyph_cache_load(glyph_cache* cache)
+{
+	int fd = open(cache->file_path, O_RDONLY);
+	if (fd < 0) {
+		return;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(glyph_cache_file_header)) {
+		close(fd);
+		return;
+	}
+
+	// Private so the last page can keep having glyphs packed into it
+	size_t len = (size_t) st.st_size;
+	uint8_t* data = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return;
+	}
+
+	const glyph_cache_file_header* header = (const glyph_cache_file_header*) data;
+	const glyph_cache_file_entry* entries = (const glyph_cache_file_entry*) (data + sizeof(glyph_cache_file_header));
+	size_t pages_offset = glyph_cache_file_pages_offset(header->entry_count >= 0 ? (size_t) header->entry_count : 0);
+
+	bool valid = header->magic == GLYPH_CACHE_FILE_MAGIC
+		&& header->version == GLYPH_CACHE_FILE_VERSION
+		&& memcmp(&header->key, &cache->key, sizeof(glyph_cache_key)) == 0
+		&& header->page_size == GLYPH_CACHE_PAGE_SIZE
+		&& header->page_count > 0
+		&& header->entry_count >= 0
+		&& header->shelf_x >= 0 && header->shelf_y >= 0 && header->shelf_h >= 0
+		&& pages_offset + (size_t) header->page_count * GLYPH_CACHE_PAGE_BYTES <= len;
+
+	for (int32_t i = 0; valid && i < header->entry_count; i++) {
+		const glyph_cache_file_entry* e = &entries[i];
+		valid = e->page < header->page_count
+			&& (e->page < 0 || (e->x >= 0 && e->y >= 0 && e->rect_w >= 0 && e->rect_h >= 0
+				&& e->x + e->rect_w <= GLYPH_CACHE_PAGE_SIZE && e->y + e->rect_h <= GLYPH_CACHE_PAGE_SIZE));
+	}
+
+	if (!valid) {
+		SDL_Log("Ignoring glyph atlas cache %s\n", cache->file_path);
+		munmap(data, len);
+		return;
+	}
+
+	for (int32_t i = 0; i < header->page_count; i++) {
+		uint32_t* pixels = (uint32_t*) (data + pages_offset + (size_t) i * GLYPH_CACHE_PAGE_BYTES);
+		SDL_Texture* texture = SDL_CreateTexture(cache->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, GLYPH_CACHE_PAGE_SIZE, GLYPH_CACHE_PAGE_SIZE);
+		if (!texture) {
+			SDL_Log("Error creating glyph atlas page: %s\n", SDL_GetError());
+			for (size_t j = 0; j < arrlenu(cache->pages); j++) {
+				SDL_DestroyTexture(cache->pages[j]);
+			}
+			arrfree(cache->pages);
+			arrfree(cache->shadows);
+			munmap(data, len);
+			return;
+		}
+
+		SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+		SDL_UpdateTexture(texture, NULL, pixels, GLYPH_CACHE_PAGE_SIZE * 4);
+		arrput(cache->pages, texture);
+		arrput(cache->shadows, pixels);
+	}
+
+	for (int32_t i = 0; i < header->entry_count; i++) {
+		const glyph_cache_file_entry* e = &entries[i];
+		glyph_cache_entry entry = {
+			.codepoint = e->codepoint,
+			.page = e->page < 0 ? -1 : e->page,
+			.rect = { e->x, e->y, e->rect_w, e->rect_h },
+			.prewarm = false,
+			.ready = true,
+		};
+
+		if (hmgeti(cache->index, entry.codepoint) < 0) {
+			hmput(cache->index, entry.codepoint, (int) arrlen(cache->entries));
+			arrput(cache->entries, entry);
+		}
+	}
+
+	cache->shelf_x = header->shelf_x;
+	cache->shelf_y = header->shelf_y;
+	cache->shelf_h = header->shelf_h;
+	cache->mapping = data;
+	cache->mapping_len = len;
+	cache->mapped_pages = header->page_count;
+
+	SDL_Log("Loaded %d glyphs from %s\n", header->entry_count, cache->file_path);
+}
+
+// Writes every finished glyph and the pages out, replacing the old file whole
+static void
+glyph_cache_save(glyph_cache* cache)
+{
+	glyph_cache_file_entry* entries = NULL;
+	for (size_t i = 0; i < arrlenu(cache->entries); i++) {
+		glyph_cache_entry* e = &cache->entries[i];
+		if (e->ready) {
+			arrput(entries, ((glyph_cache_file_entry){
+				.codepoint = e->codepoint,
+				.page = e->page,
+				.x = e->rect.x,
+				.y = e->rect.y,
+				.rect_w = e->rect.w,
+				.rect_h = e->rect.h,
+			}));
+		}
+	}
+
+	glyph_cache_file_header header = {
+		.magic = GLYPH_CACHE_FILE_MAGIC,
+		.version = GLYPH_CACHE_FILE_VERSION,
+		.key = cache->key,
+		.page_size = GLYPH_CACHE_PAGE_SIZE,
+		.page_count = (int32_t) arrlen(cache->shadows),
+		.entry_count = (int32_t) arrlen(entries),
+		.shelf_x = cache->shelf_x,
+		.shelf_y = cache->shelf_y,
+		.shelf_h = cache->shelf_h,
+	};
+
+	size_t pages_offset = glyph_cache_file_pages_offset(arrlenu(entries));
+	size_t padding = pages_offset - sizeof(header) - arrlenu(entries) * sizeof(glyph_cache_file_entry);
+	static const uint8_t zeros[GLYPH_CACHE_FILE_ALIGN];
+
+	// Written beside it and renamed over it, so a crash never leaves half a file
+	char* tmp_path = malloc(strlen(cache->file_path) + 5);
+	if (!tmp_path) {
+		arrfree(entries);
+		return;
+	}
+	strcpy(tmp_path, cache->file_path);
+	strcat(tmp_path, ".tmp");
+
+	FILE* file = fopen(tmp_path, "wb");
+	bool ok = file != NULL;
+	ok = ok && fwrite(&header, sizeof(header), 1, file) == 1;
+	ok = ok && fwrite(entries, sizeof(glyph_cache_file_entry), arrlenu(entries), file) == arrlenu(entries);
+	ok = ok && fwrite(zeros, 1, padding, file) == padding;
+	for (size_t i = 0; ok && i < arrlenu(cache->shadows); i++) {
+		ok = fwrite(cache->shadows[i], GLYPH_CACHE_PAGE_BYTES, 1, file) == 1;
+	}
+
+	if (file && fclose(file) != 0) {
+		ok = false;
+	}
+
+	if (ok && rename(tmp_path, cache->file_path) == 0) {
+		SDL_Log("Saved %d glyphs to %s\n", header.entry_count, cache->file_path);
+	} else {
+		SDL_Log("Error saving glyph atlas cache %s\n", cache->file_path);
+		remove(tmp_path);
+	}
+
+	free(tmp_path);
+	arrfree(entries);
+}
+
+// Queues a job for the workers, with the lock held
+static void
+glyph_cache_push(glyph_cache* cache, glyph_cache_queue* queue, int handle, uint32_t codepoint)
+{
+	arrput(queue->jobs, ((glyph_cache_job){ .handle = handle, .codepoint = codepoint }));
+	SDL_CondSignal(cache->wake);
+}
+
+// Takes the first job off the queue, with the lock held
+static bool
+glyph_cache_pop(glyph_cache_queue* queue, glyph_cache_job* job)
+{
+	if (queue->next == arrlenu(queue->jobs)) {
+		return false;
+	}
+
+	// Drop the taken jobs once they are half the queue, so it can't grow
+	// without bound while jobs keep arriving, and the jobs moved down never
+	// outnumber the ones dropped
+	*job = queue->jobs[queue->next++];
+	if (queue->next * 2 >= arrlenu(queue->jobs)) {
+		arrdeln(queue->jobs, 0, queue->next);
+		queue->next = 0;
+	}
+
+	return true;
+}
+
+static int
+glyph_cache_work(void* data)
+{
+	glyph_cache_worker* worker = data;
+	glyph_cache* cache = worker->cache;
+
+	SDL_LockMutex(cache->lock);
+
+	while (true) {
+		glyph_cache_job job;
+		while (!cache->quit && !glyph_cache_pop(&cache->jobs, &job) && !glyph_cache_pop(&cache->prewarm, &job)) {
+			SDL_CondWait(cache->wake, cache->lock);
+		}
+
+		if (cache->quit) {
+			break;
+		}
+
+		SDL_UnlockMutex(cache->lock);
+		glyph_cache_result result = { .handle = job.handle };
+		result.surface = glyph_cache_render(worker->font, job.codepoint);
+		SDL_LockMutex(cache->lock);
+
+		// The main thread takes every result at once, so it only needs
+		// waking for the first one
+		if (arrlenu(cache->results) == 0) {
+			SDL_PushEvent(&(SDL_Event){ .type = cache->event });
+		}
+		arrput(cache->results, result);
+	}
+
+	SDL_UnlockMutex(cache->lock);
+	return 0;
+}
+
+glyph_cache*
+glyph_cache_create(SDL_Renderer* renderer, TTF_Font* font, font_file* file, int point_size, bool persistent)
+{
+	glyph_cache* cache = calloc(1, sizeof(glyph_cache));
+	if (!cache) {
+		return NULL;
+	}
+
+	cache->renderer = renderer;
+	cache->font = font;
+	cache->file = file;
+	cache->height = TTF_FontHeight(font);
+
+	// Glyphs rendered by an earlier run with the same font and settings
+	cache->key = (glyph_cache_key){
+		.font_hash = font_file_hash(file),
+		.point_size = point_size,
+		.style = TTF_GetFontStyle(font),
+		.outline = TTF_GetFontOutline(font),
+		.hinting = TTF_GetFontHinting(font),
+	};
+	cache->file_path = persistent ? glyph_cache_file_path(&cache->key) : NULL;
+	if (cache->file_path) {
+		glyph_cache_load(cache);
+	}
+
+	cache->lock = SDL_CreateMutex();
+	cache->wake = SDL_CreateCond();
+	cache->event = SDL_RegisterEvents(1);
+	if (!cache->lock || !cache->wake || cache->event == (Uint32) -1) {
+		SDL_Log("Error starting glyph workers, rasterizing on the main thread: %s\n", SDL_GetError());
+		return cache;
+	}
+
+	// Leave a core for the main thread
+	int count = SDL_GetCPUCount() - 1;
+	count = count < 1 ? 1 : count > GLYPH_CACHE_MAX_WORKERS ? GLYPH_CACHE_MAX_WORKERS : count;
+
+	// Fonts are all opened here, FreeType can't create faces on many threads.
+	// They share the one mapping of the file.
+	for (int i = 0; i < count; i++) {
+		glyph_cache_worker* worker = &cache->workers[cache->worker_count];
+		worker->cache = cache;
+		worker->font = font_file_open(file, point_size);
+		if (!worker->font) {
+			SDL_Log("Error loading font %s for glyph worker: %s\n", font_file_path(file), TTF_GetError());
+			break;
+		}
+
+		TTF_SetFontStyle(worker->font, TTF_GetFontStyle(font));
+		TTF_SetFontOutline(worker->font, TTF_GetFontOutline(font));
+		TTF_SetFontKerning(worker->font, TTF_GetFontKerning(font));
+		TTF_SetFontHinting(worker->font, TTF_GetFontHinting(font));
+
+		worker->thread = SDL_CreateThread(glyph_cache_work, "glyph_cache", worker);
+		if (!worker->thread) {
+			SDL_Log("Error starting glyph worker: %s\n", SDL_GetError());
+			font_file_close(file, worker->font);
+			break;
+		}
+
+		cache->worker_count++;
+	}
+
+	return cache;
+}
+
+void
+glyph_cache_free(glyph_cache* cache)
+{
+	if (!cache) {
+		return;
+	}
+
+	if (cache->worker_count > 0) {
+		SDL_LockMutex(cache->lock);
+		cache->quit = true;
+		SDL_CondBroadcast(cache->wake);
+		SDL_UnlockMutex(cache->lock);
+	}
+
+	for (int i = 0; i < cache->worker_count; i++) {
+		SDL_WaitThread(cache->workers[i].thread, NULL);
+		font_file_close(cache->file, cache->workers[i].font);
+	}
+
+	// Results nobody uploaded
+	for (size_t i = 0; i < arrlenu(cache->results); i++) {
+		SDL_FreeSurface(cache->results[i].surface);
+	}
+
+	arrfree(cache->jobs.jobs);
+	arrfree(cache->prewarm.jobs);
+	arrfree(cache->results);
+
+	if (cache->wake) {
+		SDL_DestroyCond(cache->wake);
+	}
+
+	if (cache->lock) {
+		SDL_DestroyMutex(cache->lock);
+	}
+
+	if (cache->file_path && cache->dirty) {
+		glyph_cache_save(cache);
+	}
+
+	for (size_t i = 0; i < arrlenu(cache->pages); i++) {
+		SDL_DestroyTexture(cache->pages[i]);
+	}
+
+	for (size_t i = cache->mapped_pages; i < arrlenu(cache->shadows); i++) {
+		free(cache->shadows[i]);
+	}
+
+	if (cache->mapping) {
+		munmap(cache->mapping, cache->mapping_len);
+	}
+
+	free(cache->file_path);
+	arrfree(cache->shadows);
+	arrfree(cache->pages);
+	arrfree(cache->entries);
+	hmfree(cache->index);
+	hmfree(cache->kerning);
+
+	for (size_t i = 0; i < GLYPH_CACHE_ADVANCE_BLOCKS; i++) {
+		free(cache->advances[i]);
+	}
+	free(cache);
+}
+
+int
+glyph_cache_lookup(glyph_cache* cache, uint32_t codepoint)
+{
+	ptrdiff_t found = hmgeti(cache->index, codepoint);
+	if (found >= 0) {
+		int handle = cache->index[found].value;
+		glyph_cache_entry* entry = &cache->entries[handle];
+
+		// Needed now, so it shouldn't wait behind the rest of the prewarm.
+		// Whichever copy of it finishes first gets uploaded.
+		if (entry->prewarm && !entry->ready) {
+			entry->prewarm = false;
+			SDL_LockMutex(cache->lock);
+			glyph_cache_push(cache, &cache->jobs, handle, codepoint);
+			SDL_UnlockMutex(cache->lock);
+		}
+
+		return handle;
+	}
+
+	glyph_cache_entry entry = {
+		.codepoint = codepoint,
+		.page = -1,
+		.rect = { 0, 0, 0, 0 },
+		.prewarm = false,
+		.ready = false,
+	};
+
+	// Failed glyphs are still cached so they aren't retried every lookup
+	int handle = arrlen(cache->entries);
+	arrput(cache->entries, entry);
+	hmput(cache->index, codepoint, handle);
+
+	if (cache->worker_count == 0) {
+		SDL_Surface* surface = glyph_cache_render(cache->font, codepoint);
+		glyph_cache_place(cache, &cache->entries[handle], surface);
+		cache->entries[handle].ready = true;
+		SDL_FreeSurface(surface);
+		return handle;
+	}
+
+	SDL_LockMutex(cache->lock);
+	glyph_cache_push(cache, &cache->jobs, handle, codepoint);
+	SDL_UnlockMutex(cache->lock);
+
+	return handle;
+}
+
+int
+glyph_cache_advance(glyph_cache* cache, uint32_t codepoint)
+{
+	if (codepoint >= 0x110000) {
+		return 0;
+	}
+
+	int16_t** block = &cache->advances[codepoint / GLYPH_CACHE_ADVANCE_BLOCK];
+	if (!*block) {
+		*block = malloc(GLYPH_CACHE_ADVANCE_BLOCK * sizeof(int16_t));
+		if (!*block) {
+			return 0;
+		}
+
+		for (size_t i = 0; i < GLYPH_CACHE_ADVANCE_BLOCK; i++) {
+			(*block)[i] = GLYPH_CACHE_ADVANCE_UNKNOWN;
+		}
+	}
+
+	int16_t* advance = &(*block)[codepoint % GLYPH_CACHE_ADVANCE_BLOCK];
+	if (*advance == GLYPH_CACHE_ADVANCE_UNKNOWN) {
+		int a = 0;
+		if (TTF_GlyphMetrics32(cache->font, codepoint, NULL, NULL, NULL, NULL, &a) < 0) {
+			a = 0;
+		}
+		*advance = (int16_t) (a < INT16_MIN + 1 ? INT16_MIN + 1 : a > INT16_MAX ? INT16_MAX : a);
+	}
+
+	return *advance;
+}
+
+int
+glyph_cache_height(glyph_cache* cache)
+{
+	return cache->height;
+}
+
+int
+glyph_cache_kerning(glyph_cache* cache, uint32_t left, uint32_t right)
+{
+	if (!TTF_GetFontKerning(cache->font)) {
+		return 0;
+	}
+
+	uint64_t key = (uint64_t) left << 32 | right;
+	ptrdiff_t found = hmgeti(cache->kerning, key);
+	if (found >= 0) {
+		return cache->kerning[found].value;
+	}
+
+	int kern = TTF_GetFontKerningSizeGlyphs32(cache->font, left, right);
+	hmput(cache->kerning, key, kern);
+
+	return kern;
+}
+
+void
+glyph_cache_prewarm(glyph_cache* cache, uint32_t first, uint32_t last)
+{
+	// Without workers prewarming would only hold up the main thread
+	if (cache->worker_count == 0) {
+		return;
+	}
+
+	if (last > 0x10FFFF) {
+		last = 0x10FFFF;
+	}
+
+	for (uint32_t codepoint = first; codepoint <= last; codepoint++) {
+		// Surrogates aren't characters, and missing glyphs would all render
+		// the same box
+		if ((codepoint >= 0xD800 && codepoint <= 0xDFFF) || hmgeti(cache->index, codepoint) >= 0 || !TTF_GlyphIsProvided32(cache->font, codepoint)) {
+			continue;
+		}
+
+		glyph_cache_entry entry = {
+			.codepoint = codepoint,
+			.page = -1,
+			.rect = { 0, 0, 0, 0 },
+			.prewarm = true,
+			.ready = false,
+		};
+
+		int handle = arrlen(cache->entries);
+		arrput(cache->entries, entry);
+		hmput(cache->index, codepoint, handle);
+
+		SDL_LockMutex(cache->lock);
+		glyph_cache_push(cache, &cache->prewarm, handle, codepoint);
+		SDL_UnlockMutex(cache->lock);
+	}
+}
+
+Uint32
+glyph_cache_event(glyph_cache* cache)
+{
+	return cache->event;
+}
+
+int
+glyph_cache_upload(glyph_cache* cache)
+{
+	if (cache->worker_count == 0) {
+		return 0;
+	}
+
+	SDL_LockMutex(cache->lock);
+	glyph_cache_result* results = cache->results;
+	cache->results = NULL;
+	SDL_UnlockMutex(cache->lock);
+
+	int count = 0;
+	for (size_t i = 0; i < arrlenu(results); i++) {
+		glyph_cache_entry* entry = &cache->entries[results[i].handle];
+
+		// A prewarmed glyph looked up early is rasterized twice
+		if (!entry->ready) {
+			glyph_cache_place(cache, entry, results[i].surface);
+			entry->ready = true;
+
+			// Prewarmed glyphs nobody looked up aren't on screen yet
+			if (!entry->prewarm) {
+				count++;
+			}
+		}
+
+		SDL_FreeSurface(results[i].surface);
+	}
+
+	arrfree(results);
+	return count;
+}
+
+void
+glyph_cache_draw(glyph_cache* cache, const int handle, int x, int y, const SDL_Color* color)
+{
+	glyph_cache_entry* entry = &cache->entries[handle];
+	if (entry->page < 0) {
+		return;
+	}
+
+	SDL_Texture* page = cache->pages[entry->page];
+	SDL_SetTextureColorMod(page, color->r, color->g, color->b);
+	SDL_RenderCopy(cache->renderer, page, &entry->rect, &(SDL_Rect){
+		.x = x,
+		.y = y,
+		.w = entry->rect.w,
+		.h = entry->rect.h,
+	});
+}
@@ -0,0 +1,79 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+#include "font.h"
+
+/*
+ * Size in pixels of the square atlas textures glyphs are packed into.
+ */
+#define GLYPH_CACHE_PAGE_SIZE 512
+
+typedef struct glyph_cache glyph_cache;
+
+/*
+ * Creates a glyph cache that rasterizes runes from the font into atlas
+ * textures owned by the renderer. Rasterizing happens on worker threads, each
+ * with its own font opened from the font file at the point size. A persistent
+ * cache starts from the atlas saved by an earlier run and saves its own when
+ * freed, under the user cache directory.
+ */
+glyph_cache* glyph_cache_create(SDL_Renderer* renderer, TTF_Font* font, font_file* file, int point_size, bool persistent);
+
+/*
+ * Frees the glyph cache, including the atlas textures.
+ */
+void glyph_cache_free(glyph_cache* cache);
+
+/*
+ * Returns a handle to the cache entry of the codepoint.
+ * Each distinct codepoint is only rasterized the first time it is looked up,
+ * in the background, and draws nothing until it has been uploaded.
+ */
+int glyph_cache_lookup(glyph_cache* cache, uint32_t codepoint);
+
+/*
+ * Returns the advance in pixels of the codepoint from the font metrics alone,
+ * without looking it up or rasterizing it. Each codepoint is only asked of the
+ * font the first time.
+ */
+int glyph_cache_advance(glyph_cache* cache, uint32_t codepoint);
+
+/*
+ * Returns the height in pixels of every glyph of the font.
+ */
+int glyph_cache_height(glyph_cache* cache);
+
+/*
+ * Returns the kerning in pixels between two codepoints drawn one after the
+ * other, or 0 if the font has kerning turned off. Each pair is only asked of
+ * the font the first time.
+ */
+int glyph_cache_kerning(glyph_cache* cache, uint32_t left, uint32_t right);
+
+/*
+ * Queues the codepoints from first to last inclusive that the font has glyphs
+ * for to be rasterized in the background, so they are ready before they are
+ * first looked up. Glyphs looked up for drawing are rasterized ahead of them.
+ */
+void glyph_cache_prewarm(glyph_cache* cache, uint32_t first, uint32_t last);
+
+/*
+ * Returns the event type pushed when glyphs rasterized in the background are
+ * waiting to be uploaded.
+ */
+Uint32 glyph_cache_event(glyph_cache* cache);
+
+/*
+ * Uploads the glyphs rasterized in the background to the atlas textures.
+ * Must be called on the thread owning the renderer. Returns how many of the
+ * glyphs already looked up can now be drawn.
+ */
+int glyph_cache_upload(glyph_cache* cache);
+
+/*
+ * Draws the glyph behind the cache handle to the current render target at the
+ * given position, tinted with the given color.
+ */
+void glyph_cache_draw(glyph_cache* cache, const int handle, int x, int y, const SDL_Color* color);
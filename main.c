@@ -1,42 +1,82 @@
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
 
+#include "bench.h"
+#include "command.h"
+#include "event_log.h"
+#include "font.h"
 #include "glyph.h"
+#include "glyph_cache.h"
+#include "wrap.h"
 
-#define USAGE "Usage: %s <font.ttf>\n"
+#define USAGE "Usage: %s <font.ttf> [--prewarm <hex codepoint ranges, e.g. 0400-04FF,20AC>] [--bench <event script>] [--record <event log>] [--replay <event log> [--timed]]\n"
 
 #define TEXT_SIZE 40
 
-#define TEXTBOX_WIDTH 590
-#define TEXTBOX_HEIGHT (TEXT_SIZE + 2)
+#define TEXTBOX_MARGIN 25
+#define TEXTBOX_LINES 8
 
 #define TEXTBOX_PADDING_X 5
 #define TEXTBOX_PADDING_Y 2
 
 #define CURSOR_HEIGHT (TEXT_SIZE - 7)
 
+#define DAMAGE_TO_END INT64_MAX
+#define DAMAGE_TO_END_ROW ((text_row){ SIZE_MAX, 0 })
+
 static const SDL_Color white = { 255, 255, 255, 0 };
 static const SDL_Color black = {   0,   0,   0, 0 };
 static const SDL_Color red   = { 255,   0,   0, 0 };
 static const SDL_Color gray  = { 128, 128, 128, 0 };
 
+static font_file* font_source = NULL;
 static TTF_Font* font = NULL;
 static SDL_Window* window = NULL;
 static SDL_Renderer* renderer = NULL;
+static glyph_cache* cache = NULL;
 
 static int window_width = 640;
-static int window_height = 200;
-static SDL_Rect textbox = { 0, 0, TEXTBOX_WIDTH, TEXTBOX_HEIGHT };
+static int window_height = 480;
+static int line_height = TEXT_SIZE;
+static SDL_Rect textbox = { 0, 0, 640 - 2 * TEXTBOX_MARGIN, TEXT_SIZE + 2 };
 
+static bool alive = true;
 static bool focus = false;
 
+// Set when something outside the text texture needs drawing again
+static bool frame_updated = true;
+
+// A row of the wrapped text, as a line and which of its rows
+typedef struct {
+	size_t line;
+	size_t row;
+} text_row;
+
 static bool text_updated = true;
-static glyph* text = NULL;
-static glyph* composition = NULL;
+static text_row damage_first = { 0, 0 };
+static int64_t damage_from = 0;
+static int64_t damage_to = DAMAGE_TO_END;
+static text_row damage_last = DAMAGE_TO_END_ROW;
+static glyph_buffer* text = NULL;
+static glyph_buffer* composition = NULL;
+static wrap_layout* layout = NULL;
 static SDL_Texture* text_texture = NULL;
 static SDL_Rect text_rect = {};
+static text_row scroll = { 0, 0 };
+
+// Key presses and typing queued up until the rest of the batch is handled
+static command_queue* commands = NULL;
+
+// Sessions are recorded to one log and replayed from another
+static event_log* recording = NULL;
+static event_log* replay = NULL;
+static bool replay_timed = false;
+static Uint32 replay_start = 0;
+static Uint32 replay_first = 0;
 
 static bool cursor_updated = true;
 static size_t cursor_glyph_index = 0;
@@ -48,6 +88,311 @@ SDL_SetRenderDrawColorType(SDL_Renderer* renderer, const SDL_Color* color)
 	SDL_SetRenderDrawColor(renderer, color->r, color->g, color->b, color->a);
 }
 
+static bool
+text_row_equal(text_row a, text_row b)
+{
+	return a.line == b.line && a.row == b.row;
+}
+
+static bool
+text_row_before(text_row a, text_row b)
+{
+	return a.line < b.line || (a.line == b.line && a.row < b.row);
+}
+
+// Moves to the next row, returns false at the end of the text
+static bool
+text_row_next(text_row* r)
+{
+	if (r->row + 1 < wrap_rows(layout, text, r->line)) {
+		r->row++;
+		return true;
+	}
+
+	if (r->line + 1 < glyph_line_count(text)) {
+		r->line++;
+		r->row = 0;
+		return true;
+	}
+
+	return false;
+}
+
+// Moves to the previous row, returns false at the start of the text
+static bool
+text_row_prev(text_row* r)
+{
+	if (r->row > 0) {
+		r->row--;
+		return true;
+	}
+
+	if (r->line > 0) {
+		r->line--;
+		r->row = wrap_rows(layout, text, r->line) - 1;
+		return true;
+	}
+
+	return false;
+}
+
+// Pulls a row left behind by an edit or re-wrap back inside the text
+static text_row
+text_row_clamp(text_row r)
+{
+	size_t line_count = glyph_line_count(text);
+	if (r.line >= line_count) {
+		r.line = line_count - 1;
+		r.row = SIZE_MAX;
+	}
+
+	size_t rows = wrap_rows(layout, text, r.line);
+	if (r.row >= rows) {
+		r.row = rows - 1;
+	}
+
+	return r;
+}
+
+static text_row
+text_row_of(size_t index)
+{
+	return (text_row){
+		.line = glyph_line_of(text, index),
+		.row = wrap_row_of(layout, text, index),
+	};
+}
+
+static size_t
+text_row_start(text_row r)
+{
+	return wrap_row_start(layout, text, r.line, r.row);
+}
+
+static size_t
+text_row_end(text_row r)
+{
+	return wrap_row_end(layout, text, r.line, r.row);
+}
+
+// Returns the x offset in pixels of the text glyph index from its row start
+static int64_t
+text_row_x(size_t index)
+{
+	size_t start = text_row_start(text_row_of(index));
+	return glyph_x_offset(text, index) - glyph_x_offset(text, start);
+}
+
+// Returns the glyph boundary on the row closest to x pixels from its start
+static size_t
+text_index_at(text_row r, int64_t x)
+{
+	size_t start = text_row_start(r);
+	size_t end = text_row_end(r);
+	size_t index = glyph_index_at_x(text, glyph_x_offset(text, start) + x);
+
+	if (index < start) {
+		return start;
+	}
+
+	// The end of a wrapped row is the start of the next one, so stop short of it
+	if (index >= end) {
+		bool wrapped = r.row + 1 < wrap_rows(layout, text, r.line);
+		return wrapped && end > start ? end - 1 : end;
+	}
+
+	return index;
+}
+
+/*
+ * Marks the pixel columns [from, to) of the first row for redrawing, along
+ * with every row after it up to and including the last.
+ */
+static void
+damage_text(text_row first, int64_t from, int64_t to, text_row last)
+{
+	if (!text_updated) {
+		damage_first = first;
+		damage_from = from;
+		damage_to = to;
+		damage_last = last;
+	} else {
+		if (text_row_equal(first, damage_first)) {
+			damage_from = from < damage_from ? from : damage_from;
+			damage_to = to > damage_to ? to : damage_to;
+		} else if (text_row_before(first, damage_first)) {
+			damage_first = first;
+			damage_from = from;
+			damage_to = to;
+		}
+
+		if (text_row_before(damage_last, last)) {
+			damage_last = last;
+		}
+	}
+
+	text_updated = true;
+}
+
+static void
+damage_all(void)
+{
+	damage_text((text_row){ 0, 0 }, 0, DAMAGE_TO_END, DAMAGE_TO_END_ROW);
+}
+
+// The composition is drawn at the cursor so it moves along with it
+static void
+damage_composition_move(size_t from, size_t to)
+{
+	if (glyph_len(composition) == 0 || from == to) {
+		return;
+	}
+
+	size_t first = from < to ? from : to;
+	size_t last = from < to ? to : from;
+	damage_text(text_row_of(first), text_row_x(first), DAMAGE_TO_END, text_row_of(last));
+}
+
+/*
+ * Replaces count glyphs at the index with the UTF-8 string, re-wrapping and
+ * redrawing only the rows that changed. The cursor stays on the same glyph.
+ */
+static void
+edit_text(size_t index, size_t count, const char* str)
+{
+	text_row row = text_row_of(index);
+	text_row cursor_row = text_row_of(cursor_glyph_index);
+
+	// The glyph before the edit gets a new neighbour to kern with, so it's
+	// redrawn as well
+	size_t row_start = text_row_start(row);
+	int64_t x = text_row_x(index > row_start ? index - 1 : index);
+	size_t old_len = glyph_len(text);
+
+	text = glyph_remove(text, index, count);
+	text = glyph_insert(text, index, str);
+
+	size_t inserted = glyph_len(text) + count - old_len;
+	wrap_damage damage = wrap_edit(layout, text, index, count, inserted);
+
+	// The edited row keeps its glyphs up to the edit, unless the word before
+	// it moved down to the next row
+	text_row first = { damage.line, damage.first_row };
+	text_row last = { damage.line, damage.last_row };
+	int64_t from = 0;
+	if (text_row_equal(first, row)) {
+		size_t start = text_row_start(first);
+		size_t end = text_row_end(first);
+		from = end < index ? glyph_x_offset(text, end) - glyph_x_offset(text, start) : x;
+	}
+	damage_text(first, from, DAMAGE_TO_END, damage.shifted ? DAMAGE_TO_END_ROW : last);
+
+	if (cursor_glyph_index >= index + count) {
+		cursor_glyph_index = cursor_glyph_index + inserted - count;
+	} else if (cursor_glyph_index > index) {
+		cursor_glyph_index = index;
+	}
+
+	// The composition follows the cursor, which may have changed rows
+	if (glyph_len(composition) > 0) {
+		text_row new_cursor_row = text_row_of(cursor_glyph_index);
+		damage_text(cursor_row, 0, DAMAGE_TO_END, cursor_row);
+		damage_text(new_cursor_row, 0, DAMAGE_TO_END, new_cursor_row);
+	}
+
+	cursor_updated = true;
+}
+
+// Inserts UTF-8 text at the cursor and moves the cursor past it
+static void
+insert_text(const char* str)
+{
+	edit_text(cursor_glyph_index, 0, str);
+}
+
+// Moves the cursor to the text glyph index
+static void
+move_cursor(size_t index)
+{
+	damage_composition_move(cursor_glyph_index, index);
+	cursor_glyph_index = index;
+	cursor_updated = true;
+}
+
+/*
+ * Applies the queued commands in order. A merged run of them is a single edit
+ * or cursor move, so n backspaces only remove one range of n glyphs.
+ */
+static void
+apply_commands(void)
+{
+	size_t count = command_count(commands);
+	size_t len = glyph_len(text);
+
+	for (size_t i = 0; i < count; i++) {
+		command c = command_get(commands, i);
+		size_t before = cursor_glyph_index;
+		size_t after = len - cursor_glyph_index;
+
+		switch (c.kind) {
+			case COMMAND_INSERT: {
+				insert_text(c.text);
+				break;
+			}
+
+			case COMMAND_BACKSPACE: {
+				size_t n = c.count < before ? c.count : before;
+				if (n > 0) {
+					edit_text(cursor_glyph_index - n, n, NULL);
+				}
+				break;
+			}
+
+			case COMMAND_DELETE: {
+				size_t n = c.count < after ? c.count : after;
+				if (n > 0) {
+					edit_text(cursor_glyph_index, n, NULL);
+				}
+				break;
+			}
+
+			case COMMAND_LEFT: {
+				size_t n = c.count < before ? c.count : before;
+				if (n > 0) {
+					move_cursor(cursor_glyph_index - n);
+				}
+				break;
+			}
+
+			case COMMAND_RIGHT: {
+				size_t n = c.count < after ? c.count : after;
+				if (n > 0) {
+					move_cursor(cursor_glyph_index + n);
+				}
+				break;
+			}
+
+			case COMMAND_UP:
+			case COMMAND_DOWN: {
+				// Every row is landed on at the column the cursor started from
+				text_row r = text_row_of(cursor_glyph_index);
+				size_t moved = 0;
+				while (moved < c.count && (c.kind == COMMAND_UP ? text_row_prev(&r) : text_row_next(&r))) {
+					moved++;
+				}
+				if (moved > 0) {
+					move_cursor(text_index_at(r, text_row_x(cursor_glyph_index)));
+				}
+				break;
+			}
+		}
+
+		len = glyph_len(text);
+	}
+
+	command_clear(commands);
+}
+
 int
 text_draw_width(const char* text)
 {
@@ -78,42 +423,57 @@ handle_keydown(SDL_Keycode code)
 		case SDLK_ESCAPE: {
 			if (focus) {
 				focus = false;
+				frame_updated = true;
 				stop_text_input();
 			}
 			return;
 		}
 
 		case SDLK_BACKSPACE: {
-			if (focus && cursor_glyph_index > 0) {
-				text = glyph_remove(text, cursor_glyph_index - 1, 1);
-				cursor_glyph_index--;
-				text_updated = true;
-				cursor_updated = true;
+			if (focus) {
+				command_push(commands, COMMAND_BACKSPACE, NULL);
 			}
 			return;
 		}
 
 		case SDLK_DELETE: {
-			if (focus && cursor_glyph_index < glyph_len(text)) {
-				text = glyph_remove(text, cursor_glyph_index, 1);
-				text_updated = true;
-				cursor_updated = true;
+			if (focus) {
+				command_push(commands, COMMAND_DELETE, NULL);
 			}
 			return;
 		}
 
 		case SDLK_LEFT: {
-			if (focus && cursor_glyph_index > 0) {
-				cursor_glyph_index--;
-				cursor_updated = true;
+			if (focus) {
+				command_push(commands, COMMAND_LEFT, NULL);
 			}
 			return;
 		}
 
 		case SDLK_RIGHT: {
-			if (focus && cursor_glyph_index < glyph_len(text)) {
-				cursor_glyph_index++;
-				cursor_updated = true;
+			if (focus) {
+				command_push(commands, COMMAND_RIGHT, NULL);
+			}
+			return;
+		}
+
+		case SDLK_UP: {
+			if (focus) {
+				command_push(commands, COMMAND_UP, NULL);
+			}
+			return;
+		}
+
+		case SDLK_DOWN: {
+			if (focus) {
+				command_push(commands, COMMAND_DOWN, NULL);
+			}
+			return;
+		}
+
+		case SDLK_RETURN: {
+			if (focus) {
+				command_push(commands, COMMAND_INSERT, "\n");
 			}
 			return;
 		}
@@ -121,7 +481,7 @@ handle_keydown(SDL_Keycode code)
 }
 
 size_t
-get_closest_glyph_index(int x)
+get_closest_glyph_index(int x, int y)
 {
 	size_t len = glyph_len(text);
 
@@ -129,26 +489,24 @@ get_closest_glyph_index(int x)
 		return 0;
 	}
 
-	if (x >= (text_rect.x + text_rect.w)) {
-		return len;
+	// Count rows down from the top of the box
+	text_row r = text_row_clamp(scroll);
+	for (int row_y = text_rect.y + line_height; row_y <= y; row_y += line_height) {
+		if (!text_row_next(&r)) {
+			break;
+		}
 	}
 
-	if (x <= text_rect.x) {
-		return 0;
+	// Clicks outside the box land on its visible edge
+	if (x > (text_rect.x + text_rect.w)) {
+		x = text_rect.x + text_rect.w;
 	}
 
-	int offset = 0;
-	for (size_t i = 0; i < len; i++) {
-		offset += (text[i].w / 2);
-
-		if (x < (text_rect.x + offset)) {
-			return i;
-		}
-
-		offset += (text[i].w / 2);
+	if (x < text_rect.x) {
+		x = text_rect.x;
 	}
 
-	return len;
+	return text_index_at(r, x - text_rect.x);
 }
 
 void
@@ -157,6 +515,7 @@ handle_mousedown(SDL_MouseButtonEvent evt)
 	bool new_focus = SDL_PointInRect(&(SDL_Point){ evt.x, evt.y }, &textbox);
 	if (new_focus != focus) {
 		focus = new_focus;
+		frame_updated = true;
 		if (focus) {
 			start_text_input();
 			cursor_updated = true;
@@ -166,15 +525,57 @@ handle_mousedown(SDL_MouseButtonEvent evt)
 	}
 
 	if (focus) {
-		cursor_glyph_index = get_closest_glyph_index(evt.x);
-		cursor_updated = true;
+		move_cursor(get_closest_glyph_index(evt.x, evt.y));
 	}
 }
 
+// Returns the number of whole rows that fit in the box
+static size_t
+text_visible_rows(void)
+{
+	return text_rect.h / line_height;
+}
+
+// Scrolls the row to the top, but never so far that rows below the text show
+static void
+scroll_to_row(text_row top)
+{
+	size_t rows = text_visible_rows();
+	top = text_row_clamp(top);
+
+	text_row r = top;
+	size_t below = 1;
+	while (below < rows && text_row_next(&r)) {
+		below++;
+	}
+
+	while (below < rows && text_row_prev(&top)) {
+		below++;
+	}
+
+	if (!text_row_equal(top, scroll)) {
+		scroll = top;
+		damage_all();
+	}
+}
+
+void
+handle_mousewheel(SDL_MouseWheelEvent evt)
+{
+	text_row top = text_row_clamp(scroll);
+	for (int i = 0; i < 3 * abs(evt.y); i++) {
+		if (!(evt.y > 0 ? text_row_prev(&top) : text_row_next(&top))) {
+			break;
+		}
+	}
+	scroll_to_row(top);
+}
+
 void
 draw_textbox(void)
 {
-	// Recenter
+	// Recenter and follow the window width
+	textbox.w = window_width - 2 * TEXTBOX_MARGIN;
 	textbox.x = (window_width - textbox.w) / 2;
 	textbox.y = (window_height - textbox.h) / 2;
 
@@ -194,12 +595,124 @@ draw_textbox(void)
 	}
 }
 
+static void
+measure_glyph(glyph* g)
+{
+	// Newlines only break lines, they have no width and nothing to draw
+	if (g->codepoint == '\n') {
+		return;
+	}
+
+	// Layout only needs the metrics, glyphs are rasterized once drawn
+	g->w = glyph_cache_advance(cache, g->codepoint);
+	g->h = glyph_cache_height(cache);
+}
+
 static int
-draw_glyph(glyph* g, int x)
+kern_glyphs(uint32_t left, uint32_t right)
+{
+	// Nothing kerns across the end of a line
+	if (left == '\n' || right == '\n') {
+		return 0;
+	}
+
+	return glyph_cache_kerning(cache, left, right);
+}
+
+/*
+ * Draws the glyphs [from, to) of buf with the first one at pixel x, limited
+ * to those overlapping the pixel columns [min_x, max_x).
+ */
+static void
+draw_glyphs(glyph_buffer* buf, size_t from, size_t to, int64_t x, int y, int64_t min_x, int64_t max_x, const SDL_Color* color)
+{
+	if (from >= to || x >= max_x) {
+		return;
+	}
+
+	// Jump straight to the glyph under min_x
+	if (min_x > x) {
+		int64_t base = glyph_x_offset(buf, from);
+		int64_t target = base + (min_x - x);
+		size_t first = glyph_index_at_x(buf, target);
+		if (first > 0 && glyph_x_offset(buf, first) > target) {
+			first--;
+		}
+
+		// Kerning can pull a glyph under the end of the one before it
+		if (first > from) {
+			first--;
+		}
+		if (first >= to) {
+			return;
+		}
+		if (first > from) {
+			x += glyph_x_offset(buf, first) - base;
+			from = first;
+		}
+	}
+
+	glyph_iter it = glyph_iter_at(buf, from);
+	glyph_span span;
+
+	while (from < to && x < max_x && glyph_iter_next(&it, &span)) {
+		for (size_t i = 0; i < span.len && from < to && x < max_x; i++, from++) {
+			if (span.codepoints[i] != '\n') {
+				glyph_cache_draw(cache, glyph_cache_lookup(cache, span.codepoints[i]), (int) x, y, color);
+			}
+			x += span.w[i] + span.kern[i];
+		}
+	}
+
+	glyph_iter_free(&it);
+}
+
+// Draws the columns [min_x, max_x) of a row, with the composition at the cursor
+static void
+draw_row(text_row r, text_row cursor_row, int y, int64_t min_x, int64_t max_x)
 {
-	SDL_Rect glyph_rect = { .x = x, .y = 0, .w = g->w, .h = g->h };
-	SDL_RenderCopy(renderer, g->texture, NULL, &glyph_rect);
-	return x + g->w;
+	size_t start = text_row_start(r);
+	size_t end = text_row_end(r);
+
+	if (!text_row_equal(r, cursor_row)) {
+		draw_glyphs(text, start, end, 0, y, min_x, max_x, &black);
+		return;
+	}
+
+	size_t composition_len = glyph_len(composition);
+	int64_t composition_x = glyph_x_offset(text, cursor_glyph_index) - glyph_x_offset(text, start);
+	int64_t composition_w = glyph_x_offset(composition, composition_len);
+	draw_glyphs(text, start, cursor_glyph_index, 0, y, min_x, max_x, &black);
+	draw_glyphs(composition, 0, composition_len, composition_x, y, min_x, max_x, &gray);
+	draw_glyphs(text, cursor_glyph_index, end, composition_x + composition_w, y, min_x, max_x, &black);
+}
+
+// Scrolls the text just enough to bring the cursor row into view
+static void
+scroll_to_cursor(void)
+{
+	text_row cursor_row = text_row_of(cursor_glyph_index);
+	text_row top = text_row_clamp(scroll);
+	size_t rows = text_visible_rows();
+
+	if (text_row_before(cursor_row, top)) {
+		scroll_to_row(cursor_row);
+		return;
+	}
+
+	// Look for the cursor at most a box worth of rows down
+	text_row r = top;
+	for (size_t i = 0; i < rows; i++) {
+		if (text_row_equal(r, cursor_row) || !text_row_next(&r)) {
+			scroll_to_row(top);
+			return;
+		}
+	}
+
+	// Otherwise put it on the bottom row
+	top = cursor_row;
+	for (size_t i = 1; i < rows && text_row_prev(&top); i++);
+	scroll_to_row(top);
 }
 
 void
@@ -216,83 +729,93 @@ draw_text(void)
 	// TODO: Figure out if this works?
 	SDL_SetTextInputRect(&text_rect);
 
-	if (text_updated) {
-		size_t text_len = glyph_len(text);
-		size_t composition_len = glyph_len(composition);
-
-		// Ensure each glyph in composition has a texture
-		if (composition_len > 0) {
-			for (size_t i = 0; i < composition_len; i++) { 
-				if (!composition[i].texture) {
-					SDL_Surface* glyph_surface = TTF_RenderUTF8_Solid(font, composition[i].utf8, gray);
-
-					composition[i].texture = SDL_CreateTextureFromSurface(renderer, glyph_surface);
-					composition[i].w = glyph_surface->w;
-					composition[i].h = glyph_surface->h;
-
-					SDL_FreeSurface(glyph_surface);
-				}
-			};
-		}
+	// Rows wrap to leave room for the cursor at their end
+	int width = text_rect.w - cursor_rect.w;
+	if (width != wrap_width(layout)) {
+		// Keep the same text at the top, re-wrapping starts from there
+		size_t top = text_row_start(text_row_clamp(scroll));
+		wrap_set_width(layout, width);
+		scroll = text_row_of(top);
 
-		// Ensure each glyph in text has a texture
-		if (text_len > 0) {
-			for (size_t i = 0; i < text_len; i++) { 
-				if (!text[i].texture) {
-					SDL_Surface* glyph_surface = TTF_RenderUTF8_Solid(font, text[i].utf8, black);
+		damage_all();
+		cursor_updated = true;
+	}
 
-					text[i].texture = SDL_CreateTextureFromSurface(renderer, glyph_surface);
-					text[i].w = glyph_surface->w;
-					text[i].h = glyph_surface->h;
+	if (cursor_updated) {
+		scroll_to_cursor();
+	}
 
-					SDL_FreeSurface(glyph_surface);
-				}
-			};
+	// Recreate the texture if the box changed size
+	if (text_texture) {
+		int w = 0;
+		int h = 0;
+		SDL_QueryTexture(text_texture, NULL, NULL, &w, &h);
+		if (w != text_rect.w || h != text_rect.h) {
+			SDL_DestroyTexture(text_texture);
+			text_texture = NULL;
 		}
+	}
 
+	if (text_updated) {
 		// Initialise texture it doesn't exist
 		if (!text_texture) {
 			text_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_UNKNOWN, SDL_TEXTUREACCESS_TARGET, text_rect.w, text_rect.h);
+			damage_all();
 		}
 
 		// Set render target to texture
 		SDL_SetRenderTarget(renderer, text_texture);
-
-		// Clear White
 		SDL_SetRenderDrawColorType(renderer, &white);
-		SDL_RenderClear(renderer);
-
-		int x_offset = 0;
-
-		// Draw text
-		if (text_len > 0) {
-			for (size_t i = 0; i < text_len; i++) {
-				// Draw composition if it is inside or at the beginning of text
-				if (i == cursor_glyph_index && composition_len > 0) {
-					for (size_t c = 0; c < composition_len; c++) {
-						x_offset = draw_glyph(&composition[c], x_offset);
-					}
+
+		// Only the damaged parts of the visible rows get cleared and redrawn
+		size_t rows = (text_rect.h + line_height - 1) / line_height;
+		text_row cursor_row = text_row_of(cursor_glyph_index);
+		text_row r = text_row_clamp(scroll);
+		bool more = true;
+
+		for (size_t row = 0; row < rows; row++, more = more && text_row_next(&r)) {
+			int64_t from = 0;
+			int64_t to = text_rect.w;
+
+			// Rows past the end of the text are only cleared
+			if (more) {
+				if (text_row_before(r, damage_first)) {
+					continue;
+				}
+
+				if (text_row_before(damage_last, r)) {
+					break;
 				}
-				x_offset = draw_glyph(&text[i], x_offset);
+
+				if (text_row_equal(r, damage_first)) {
+					from = damage_from > 0 ? damage_from : 0;
+					to = damage_to < text_rect.w ? damage_to : text_rect.w;
+				}
+			} else if (damage_last.line != SIZE_MAX) {
+				break;
+			}
+
+			if (from >= to) {
+				continue;
 			}
-		}
 
-		// Draw composition if it is at the end
-		if (cursor_glyph_index == text_len && composition_len > 0) {
-			for (size_t c = 0; c < composition_len; c++) {
-				x_offset = draw_glyph(&composition[c], x_offset);
+			SDL_Rect damage = { (int) from, (int) row * line_height, (int) (to - from), line_height };
+			SDL_RenderSetClipRect(renderer, &damage);
+
+			// Clear White
+			SDL_RenderFillRect(renderer, &damage);
+
+			if (more) {
+				draw_row(r, cursor_row, damage.y, from, to);
 			}
 		}
 
 		// Set render target back to window
+		SDL_RenderSetClipRect(renderer, NULL);
 		SDL_SetRenderTarget(renderer, NULL);
 		text_updated = false;
 
-		char* glyph_str = glyph_to_string(text);
-		SDL_Log("Current Text: %s\n", glyph_str);
-		if (glyph_str) {
-			free(glyph_str);
-		}
+		SDL_Log("Current Text: %zu glyphs, %zu lines\n", glyph_len(text), glyph_line_count(text));
 	}
 
 	if (text_texture) {
@@ -304,30 +827,229 @@ void
 draw_cursor(void)
 {
 	if (cursor_updated) {
-		// Recenter
-		cursor_rect.x = text_rect.x;
-		cursor_rect.y = text_rect.y;
+		cursor_updated = false;
+		SDL_Log("Cursor Glyph Index: %zu\n", cursor_glyph_index);
+	}
 
-		int cursor_offset = 0;
+	// Find the cursor among the visible rows, it may be scrolled out of sight
+	text_row cursor_row = text_row_of(cursor_glyph_index);
+	text_row r = text_row_clamp(scroll);
+	size_t rows = text_visible_rows();
+	bool visible = false;
 
-		if (cursor_glyph_index != 0) {
-			for (size_t i = 0; i < cursor_glyph_index; i++) {
-				cursor_offset += text[i].w;
-			}
+	for (size_t row = 0; row < rows; row++) {
+		if (text_row_equal(r, cursor_row)) {
+			cursor_rect.y = text_rect.y + (int) row * line_height;
+			visible = true;
+			break;
 		}
 
-		cursor_rect.x += cursor_offset;
-
-		cursor_updated = false;
-		SDL_Log("Cursor Glyph Index: %zu\n", cursor_glyph_index);
+		if (!text_row_next(&r)) {
+			break;
+		}
 	}
 
-	if (focus) {
+	cursor_rect.x = text_rect.x + (int) text_row_x(cursor_glyph_index);
+
+	if (focus && visible) {
 		SDL_SetRenderDrawColorType(renderer, &black);
 		SDL_RenderFillRect(renderer, &cursor_rect);
 	}
 }
 
+// Applies a single event to the text and the view
+static void
+handle_event(const SDL_Event* e)
+{
+	switch (e->type) {
+		case SDL_QUIT: {
+			alive = false;
+			break;
+		}
+
+		case SDL_WINDOWEVENT: {
+			if (e->window.event == SDL_WINDOWEVENT_RESIZED) {
+				window_width = e->window.data1;
+				window_height = e->window.data2;
+
+				damage_all();
+				cursor_updated = true;
+				frame_updated = true;
+			}
+
+			// The window lost its contents and has to be drawn again
+			if (e->window.event == SDL_WINDOWEVENT_EXPOSED) {
+				frame_updated = true;
+			}
+			break;
+		}
+
+		// Clicks, scrolling and the composition depend on where the queued
+		// commands leave the cursor and text
+		case SDL_MOUSEBUTTONDOWN: {
+			apply_commands();
+			handle_mousedown(e->button);
+			break;
+		}
+
+		case SDL_MOUSEWHEEL: {
+			apply_commands();
+			handle_mousewheel(e->wheel);
+			break;
+		}
+
+		case SDL_KEYDOWN: {
+			handle_keydown(e->key.keysym.sym);
+			break;
+		}
+
+		case SDL_TEXTINPUT: {
+			if (focus) {
+				command_push(commands, COMMAND_INSERT, e->text.text);
+			}
+			SDL_Log("Text Input Event: %s\n", e->text.text);
+			break;
+		}
+
+		case SDL_TEXTEDITING: {
+			apply_commands();
+			if (focus) {
+				int64_t old_width = glyph_x_offset(composition, glyph_len(composition));
+
+				if (composition) {
+					glyph_free(composition);
+					composition = NULL;
+				}
+
+				const char* new_comp = e->edit.text;
+				if (new_comp && new_comp[0]) {
+					composition = glyph_insert(composition, 0, new_comp);
+				}
+
+				// The composition isn't wrapped so it only changes its own row,
+				// and only its own span if it kept its width
+				int64_t new_width = glyph_x_offset(composition, glyph_len(composition));
+				text_row row = text_row_of(cursor_glyph_index);
+				int64_t x = text_row_x(cursor_glyph_index);
+				damage_text(row, x, new_width == old_width ? x + new_width : DAMAGE_TO_END, row);
+			}
+			SDL_Log("Text Editing Event: text: %s, start: %d, length: %d timestamp: %d\n", e->edit.text, e->edit.start, e->edit.length, e->edit.timestamp);
+			break;
+		}
+
+		default: {
+			// Glyphs laid out while they were rasterizing can be drawn now
+			if (e->type == glyph_cache_event(cache) && glyph_cache_upload(cache) > 0) {
+				damage_all();
+			}
+			break;
+		}
+	}
+}
+
+// Draws the whole window and presents it
+static void
+render_frame(void)
+{
+	SDL_SetRenderDrawColorType(renderer, &white);
+	SDL_RenderClear(renderer);
+
+	draw_textbox();
+	draw_text();
+	draw_cursor();
+
+	SDL_RenderPresent(renderer);
+	frame_updated = false;
+}
+
+// Prewarms comma separated hex codepoints or ranges of them, like 0400-04FF,20AC
+static bool
+prewarm_ranges(const char* ranges)
+{
+	const char* p = ranges;
+	while (*p) {
+		char* end = NULL;
+		unsigned long first = strtoul(p, &end, 16);
+		if (end == p) {
+			return false;
+		}
+
+		unsigned long last = first;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtoul(p, &end, 16);
+			if (end == p) {
+				return false;
+			}
+		}
+
+		if (*end != ',' && *end != '\0') {
+			return false;
+		}
+
+		glyph_cache_prewarm(cache, (uint32_t) first, (uint32_t) last);
+		p = *end == ',' ? end + 1 : end;
+	}
+
+	return true;
+}
+
+// Draws the frame, if anything changed
+static void
+draw_batch(void)
+{
+	// Nothing changed, so the last frame is still on screen
+	if (frame_updated || text_updated || cursor_updated) {
+		render_frame();
+	}
+}
+
+// Applies a batch of events and draws it
+static void
+finish_batch(void)
+{
+	apply_commands();
+	draw_batch();
+}
+
+// Handles the next batch of the replay, returns false once it is all replayed
+static bool
+replay_batch(void)
+{
+	// Only glyph uploads and closing the window get through, anything else
+	// would make the replay differ from the recording
+	SDL_Event e;
+	while (SDL_PollEvent(&e)) {
+		if (e.type == SDL_QUIT || e.type == glyph_cache_event(cache)) {
+			handle_event(&e);
+		}
+	}
+
+	bool last = false;
+	bool replayed = false;
+	while (alive && !last && event_log_read(replay, &e, &last)) {
+		if (event_log_count(replay) == 1) {
+			replay_start = SDL_GetTicks();
+			replay_first = e.common.timestamp;
+		}
+
+		// Wait until the event is as far into the replay as it was into the
+		// recording
+		if (replay_timed) {
+			Uint32 due = replay_start + (e.common.timestamp - replay_first);
+			Uint32 now = SDL_GetTicks();
+			if ((Sint32) (due - now) > 0) {
+				SDL_Delay(due - now);
+			}
+		}
+
+		handle_event(&e);
+		replayed = true;
+	}
+
+	return replayed;
+}
+
 int
 main(int argc, char* argv[])
 {
@@ -336,13 +1058,55 @@ main(int argc, char* argv[])
 		return EXIT_FAILURE;
 	}
 
+	const char* prewarm = NULL;
+	const char* bench = NULL;
+	const char* record_path = NULL;
+	const char* replay_path = NULL;
+	for (int i = 2; i < argc; i++) {
+		if (strcmp(argv[i], "--prewarm") == 0 && i + 1 < argc) {
+			prewarm = argv[++i];
+		} else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+			bench = argv[++i];
+		} else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+			record_path = argv[++i];
+		} else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+			replay_path = argv[++i];
+		} else if (strcmp(argv[i], "--timed") == 0) {
+			replay_timed = true;
+		} else {
+			SDL_Log(USAGE, argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (replay_path) {
+		replay = event_log_load(replay_path);
+		if (!replay) {
+			SDL_Log("Error loading event log %s\n", replay_path);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (record_path) {
+		recording = event_log_create(record_path);
+		if (!recording) {
+			SDL_Log("Error creating event log %s\n", record_path);
+			event_log_free(replay);
+			return EXIT_FAILURE;
+		}
+	}
+
 	// Init SDL TTF
 	TTF_Init();
 
-	// Load font
-	font = TTF_OpenFont(argv[1], TEXT_SIZE);
+	// Load font, every size of it is opened from the one mapping
+	font_source = font_file_load(argv[1]);
+	font = font_source ? font_file_open(font_source, TEXT_SIZE) : NULL;
 	if (font == NULL) {
 		SDL_Log("Error loading font %s (%dpt): %s\n", argv[1], TEXT_SIZE, TTF_GetError());
+		font_file_free(font_source);
+		event_log_free(recording);
+		event_log_free(replay);
 		TTF_Quit();
 		return EXIT_FAILURE;
 	}
@@ -353,12 +1117,43 @@ main(int argc, char* argv[])
 	TTF_SetFontKerning(font, 1);
 	TTF_SetFontHinting(font, TTF_HINTING_NORMAL);
 
+	// Size the textbox to fit its lines
+	line_height = TTF_FontLineSkip(font);
+	textbox.h = TEXTBOX_LINES * line_height + 2 + TEXTBOX_PADDING_Y;
+
+	// Benchmarks run headless, without a display or a GPU, and only print
+	// their results
+	if (bench) {
+		SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+		SDL_SetHint(SDL_HINT_RENDER_DRIVER, "software");
+		SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_WARN);
+	}
+
 	// Init SDL
 	SDL_Init(SDL_INIT_VIDEO);
 	int flags = SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE;
 	SDL_CreateWindowAndRenderer(window_width, window_height, flags, &window, &renderer);
 	SDL_SetWindowTitle(window, "SDL Text Test");
 
+	// Benchmarks start from an empty atlas every run, so a saved one can't
+	// change their numbers
+	cache = glyph_cache_create(renderer, font, font_source, TEXT_SIZE, !bench);
+	glyph_set_measure(measure_glyph);
+	glyph_set_kern(kern_glyphs);
+	layout = wrap_create();
+	commands = command_create();
+
+	// Rasterize the glyphs most likely to be typed while the window opens.
+	// Benchmarks only prewarm the ranges they are given, so the workers
+	// don't compete with the timed events unless asked to.
+	if (!bench) {
+		glyph_cache_prewarm(cache, 0x20, 0x7E);
+		glyph_cache_prewarm(cache, 0xA0, 0xFF);
+	}
+	if (prewarm && !prewarm_ranges(prewarm)) {
+		SDL_Log("Invalid prewarm ranges: %s\n", prewarm);
+	}
+
 	// text input is autostarted on desktop but we don't want that
 	SDL_StopTextInput();
 
@@ -369,100 +1164,75 @@ main(int argc, char* argv[])
 	SDL_TTF_VERSION(&version);
 	SDL_Log("Using SDL_TTF v%d.%d.%d\n", version.major, version.minor, version.patch);
 
-	bool alive = true;
 	SDL_Event e = {};
+	int status = EXIT_SUCCESS;
 
-	// Main loop
-	while (SDL_WaitEvent(&e)) {
-		if (!alive) {
-			break;
+	if (bench) {
+		// The script stands in for the user, batches and all
+		if (!bench_run(bench, handle_event, apply_commands, draw_batch)) {
+			status = EXIT_FAILURE;
 		}
+		alive = false;
+	}
 
-		// --- Begin Inputs ---
-		switch (e.type) {
-			case SDL_QUIT: {
-				alive = false;
-				break;
-			}
-
-			case SDL_WINDOWEVENT: {
-				if (e.window.event == SDL_WINDOWEVENT_RESIZED) {
-					window_width = e.window.data1;
-					window_height = e.window.data2;
-
-					text_updated = true;
-					cursor_updated = true;
-				}
-				break;
-			}
-
-			case SDL_MOUSEBUTTONDOWN: {
-				handle_mousedown(e.button);
-				break;
-			}
-
-			case SDL_KEYDOWN: {
-				handle_keydown(e.key.keysym.sym);
-				break;
-			}
+	// Replays stand in for the user the whole way through, then quit
+	while (alive && replay) {
+		if (!replay_batch()) {
+			SDL_Log("Replayed %zu events in %u ms\n", event_log_count(replay), SDL_GetTicks() - replay_start);
+			alive = false;
+			break;
+		}
 
-			case SDL_TEXTINPUT: {
-				if (focus) {
-					size_t old_len = glyph_len(text);
-					text = glyph_insert(text, cursor_glyph_index, e.text.text);
-					size_t new_len = glyph_len(text);
-					cursor_glyph_index += (new_len - old_len);
+		if (alive) {
+			finish_batch();
+		}
+	}
 
-					text_updated = true;
-					cursor_updated = true;
-				}
-				SDL_Log("Text Input Event: %s\n", e.text.text);
-				break;
+	// Main loop
+	while (alive && SDL_WaitEvent(&e)) {
+		// Apply everything already queued, then draw once for the whole batch
+		do {
+			// Glyph uploads come from the app itself, a replay brings its own
+			if (recording && e.type != glyph_cache_event(cache)) {
+				event_log_write(recording, &e);
 			}
+			handle_event(&e);
+		} while (alive && SDL_PollEvent(&e));
 
-			case SDL_TEXTEDITING: {
-				if (focus) {
-					if (composition) {
-						glyph_free(composition);
-						composition = NULL;
-					}
-
-					char* new_comp = e.edit.text;
-					if (new_comp && new_comp[0]) {
-						composition = glyph_insert(composition, 0, new_comp);
-					}
-
-					text_updated = true;
-				}
-				SDL_Log("Text Editing Event: text: %s, start: %d, length: %d timestamp: %d\n", e.edit.text, e.edit.start, e.edit.length, e.edit.timestamp);
-				break;
-			}
+		if (recording) {
+			event_log_end_batch(recording);
 		}
-		// --- End Inputs ---
 
-		// --- Begin Draw ---
-		SDL_SetRenderDrawColorType(renderer, &white);
-		SDL_RenderClear(renderer);
-
-		draw_textbox();
-		draw_text();
-		draw_cursor();
+		if (!alive) {
+			break;
+		}
 
-		SDL_RenderPresent(renderer);
-		// --- End Draw ---
+		finish_batch();
 	}
 
 	if (text) {
 		glyph_free(text);
 	}
 
+	if (composition) {
+		glyph_free(composition);
+	}
+
+	command_free(commands);
+	wrap_free(layout);
+	glyph_cache_free(cache);
+
 	if (text_texture) {
 		SDL_DestroyTexture(text_texture);
 	}
 
-	TTF_CloseFont(font);
+	event_log_free(recording);
+	event_log_free(replay);
+
+	font_file_close(font_source, font);
+	font_file_free(font_source);
 	SDL_Quit();
 	TTF_Quit();
 
-	return EXIT_SUCCESS;
+	return status;
 }
@@ -0,0 +1,745 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench_util.h"
+#include "glyph.h"
+#include "utf8.h"
+
+// Most times an op runs per round, so ops that add to the text can't grow it
+// by more than this either
+#define BENCH_MAX_REPS 4096
+
+// Runes an op that is linear in the text size gets through per round
+#define BENCH_LINEAR_WORK (1 << 20)
+
+#define BENCH_ROUNDS 5
+
+// Least time a round keeps running the op for, so timer resolution and
+// one-off stalls don't decide its cost
+#define BENCH_ROUND_SECONDS 0.01
+
+#define BENCH_MAX_SIZES 16
+
+// How much faster than expected the cost of an op can grow with the size of
+// the text, as a power of the size fitted across every size, before it is
+// flagged
+#define BENCH_SLACK 0.5
+
+typedef struct {
+	const char* name;
+	double at;
+} bench_position;
+
+static const bench_position positions[] = {
+	{ "start", 0.0 },
+	{ "middle", 0.5 },
+	{ "end", 1.0 },
+};
+
+static const size_t default_sizes[] = { 1024, 8192, 65536, 262144 };
+
+/*
+ * Text an op runs on, rebuilt for every script, size and position.
+ */
+typedef struct {
+	size_t size;
+
+	// Rune index and byte offset of the edit position, and of the rune there
+	// or the last one for ops that read it
+	size_t index;
+	size_t byte_index;
+	size_t read_byte_index;
+
+	// Rune of the script that edits add
+	char piece[5];
+	size_t piece_len;
+	uint32_t codepoint;
+
+	char* str;
+	size_t len;
+	uint32_t* codepoints;
+	glyph_buffer* glyphs;
+	utf8_buf buf;
+
+	// Strings returned by an op and buffers for it to free, freed or filled
+	// outside of the timing
+	char* results[BENCH_MAX_REPS];
+	utf8_buf bufs[BENCH_MAX_REPS];
+} bench_fixture;
+
+typedef void (*bench_fn)(bench_fixture* f, size_t reps);
+
+typedef struct {
+	const char* name;
+
+	// Power of the text size a single run of the op is expected to grow with,
+	// 0 for constant or logarithmic and 1 for linear
+	int order;
+
+	bool positional;
+	bool grows;
+
+	// Setup and teardown are untimed and can be NULL
+	bench_fn setup;
+	bench_fn run;
+	bench_fn teardown;
+} bench_op;
+
+static volatile size_t sink;
+static size_t allocs;
+
+// Every allocation made by the text model is counted, the Makefile links with
+// -Wl,--wrap for each of these
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void*
+__wrap_malloc(size_t size)
+{
+	allocs++;
+	return __real_malloc(size);
+}
+
+void*
+__wrap_calloc(size_t count, size_t size)
+{
+	allocs++;
+	return __real_calloc(count, size);
+}
+
+void*
+__wrap_realloc(void* ptr, size_t size)
+{
+	allocs++;
+	return __real_realloc(ptr, size);
+}
+
+// Sized like the app would, from a table, without a font or a window
+static void
+measure_glyph(glyph* g)
+{
+	g->w = g->codepoint < 0x1100 ? 10 : 20;
+	g->h = 20;
+}
+
+static void
+free_results(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		free(f->results[i]);
+		f->results[i] = NULL;
+	}
+}
+
+static void
+run_glyph_append(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		f->glyphs = glyph_append(f->glyphs, f->piece);
+	}
+}
+
+static void
+undo_glyph_append(bench_fixture* f, size_t reps)
+{
+	f->glyphs = glyph_remove(f->glyphs, f->size, reps);
+}
+
+static void
+run_glyph_insert(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		f->glyphs = glyph_insert(f->glyphs, f->index, f->piece);
+	}
+}
+
+static void
+run_glyph_remove(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		f->glyphs = glyph_remove(f->glyphs, f->index, 1);
+	}
+}
+
+static void
+undo_glyph_insert(bench_fixture* f, size_t reps)
+{
+	f->glyphs = glyph_remove(f->glyphs, f->index, reps);
+}
+
+static void
+run_glyph_to_string(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		f->results[i] = glyph_to_string(f->glyphs);
+	}
+}
+
+static void
+run_utf8_from_literal(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		f->results[i] = utf8_from_literal(f->str);
+	}
+}
+
+static void
+run_utf8_is_rune_start(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		sink += utf8_is_rune_start(f->str[f->read_byte_index + (i & 3) % f->piece_len]);
+	}
+}
+
+static void
+run_utf8_rune_count(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		sink += utf8_rune_count(f->str);
+	}
+}
+
+static void
+run_utf8_rune_count_n(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		sink += utf8_rune_count_n(f->str, f->len);
+	}
+}
+
+static void
+run_utf8_validate(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		size_t runes = 0;
+		sink += utf8_validate(f->str, f->len, &runes);
+		sink += runes;
+	}
+}
+
+static void
+run_utf8_decode(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		sink += utf8_decode(&f->str[f->read_byte_index], NULL);
+	}
+}
+
+static void
+run_utf8_decode_n(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		sink += utf8_decode_n(f->str, f->len, f->codepoints);
+	}
+}
+
+static void
+run_utf8_encode(bench_fixture* f, size_t reps)
+{
+	char out[4];
+	for (size_t i = 0; i < reps; i++) {
+		sink += utf8_encode(f->codepoint + (i & 1), out);
+		sink += out[0];
+	}
+}
+
+static void
+run_utf8_append(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		f->str = utf8_append(f->str, f->piece);
+	}
+}
+
+static void
+undo_utf8_append(bench_fixture* f, size_t reps)
+{
+	(void) reps;
+	f->str[f->len] = '\0';
+}
+
+static void
+run_utf8_prepend(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		f->str = utf8_prepend(f->str, f->piece);
+	}
+}
+
+static void
+undo_utf8_prepend(bench_fixture* f, size_t reps)
+{
+	memmove(f->str, &f->str[reps * f->piece_len], f->len + 1);
+}
+
+static void
+run_utf8_rune_to_byte_index(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		sink += utf8_rune_to_byte_index(f->str, f->index);
+	}
+}
+
+static void
+run_utf8_runes_from_left(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		f->results[i] = utf8_runes_from_left(f->str, f->index);
+	}
+}
+
+static void
+run_utf8_insert(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		f->str = utf8_insert(f->str, f->index, f->piece);
+	}
+}
+
+static void
+run_utf8_remove(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		f->str = utf8_remove(f->str, f->index, 1);
+	}
+}
+
+static void
+undo_utf8_insert(bench_fixture* f, size_t reps)
+{
+	f->str = utf8_remove(f->str, f->index, reps);
+}
+
+static void
+run_utf8_buf_reserve(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		sink += utf8_buf_reserve(&f->buf, f->buf.len + 1);
+	}
+}
+
+static void
+run_utf8_buf_index(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		sink += utf8_buf_index(&f->buf);
+	}
+}
+
+static void
+run_utf8_buf_rune_to_byte_index(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		sink += utf8_buf_rune_to_byte_index(&f->buf, f->index);
+	}
+}
+
+static void
+run_utf8_buf_runes_from_left(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		f->results[i] = utf8_buf_runes_from_left(&f->buf, f->index);
+	}
+}
+
+static void
+run_utf8_buf_append(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		sink += utf8_buf_append(&f->buf, f->piece);
+	}
+}
+
+static void
+undo_utf8_buf_append(bench_fixture* f, size_t reps)
+{
+	utf8_buf_remove(&f->buf, f->size, reps);
+}
+
+static void
+run_utf8_buf_prepend(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		sink += utf8_buf_prepend(&f->buf, f->piece);
+	}
+}
+
+static void
+undo_utf8_buf_prepend(bench_fixture* f, size_t reps)
+{
+	utf8_buf_remove(&f->buf, 0, reps);
+}
+
+static void
+run_utf8_buf_insert(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		sink += utf8_buf_insert(&f->buf, f->index, f->piece);
+	}
+}
+
+static void
+run_utf8_buf_remove(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		utf8_buf_remove(&f->buf, f->index, 1);
+	}
+}
+
+static void
+undo_utf8_buf_insert(bench_fixture* f, size_t reps)
+{
+	utf8_buf_remove(&f->buf, f->index, reps);
+}
+
+static void
+fill_utf8_bufs(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		f->bufs[i] = (utf8_buf){ 0 };
+		utf8_buf_append(&f->bufs[i], f->piece);
+	}
+}
+
+static void
+run_utf8_buf_free(bench_fixture* f, size_t reps)
+{
+	for (size_t i = 0; i < reps; i++) {
+		utf8_buf_free(&f->bufs[i]);
+	}
+}
+
+// The setup of ops that remove is the op that adds what they remove
+static void
+setup_glyph_remove(bench_fixture* f, size_t reps)
+{
+	run_glyph_insert(f, reps);
+}
+
+static void
+setup_utf8_remove(bench_fixture* f, size_t reps)
+{
+	run_utf8_insert(f, reps);
+}
+
+static void
+setup_utf8_buf_remove(bench_fixture* f, size_t reps)
+{
+	run_utf8_buf_insert(f, reps);
+}
+
+static const bench_op ops[] = {
+	{ "glyph_append", 0, false, true, NULL, run_glyph_append, undo_glyph_append },
+	{ "glyph_insert", 0, true, true, NULL, run_glyph_insert, undo_glyph_insert },
+	{ "glyph_remove", 0, true, true, setup_glyph_remove, run_glyph_remove, NULL },
+	{ "glyph_to_string", 1, false, false, NULL, run_glyph_to_string, free_results },
+
+	{ "utf8_from_literal", 1, false, false, NULL, run_utf8_from_literal, free_results },
+	{ "utf8_is_rune_start", 0, true, false, NULL, run_utf8_is_rune_start, NULL },
+	{ "utf8_rune_count", 1, false, false, NULL, run_utf8_rune_count, NULL },
+	{ "utf8_rune_count_n", 1, false, false, NULL, run_utf8_rune_count_n, NULL },
+	{ "utf8_validate", 1, false, false, NULL, run_utf8_validate, NULL },
+	{ "utf8_decode", 0, true, false, NULL, run_utf8_decode, NULL },
+	{ "utf8_decode_n", 1, false, false, NULL, run_utf8_decode_n, NULL },
+	{ "utf8_encode", 0, false, false, NULL, run_utf8_encode, NULL },
+	{ "utf8_append", 1, false, true, NULL, run_utf8_append, undo_utf8_append },
+	{ "utf8_prepend", 1, false, true, NULL, run_utf8_prepend, undo_utf8_prepend },
+	{ "utf8_rune_to_byte_index", 1, true, false, NULL, run_utf8_rune_to_byte_index, NULL },
+	{ "utf8_runes_from_left", 1, true, false, NULL, run_utf8_runes_from_left, free_results },
+	{ "utf8_insert", 1, true, true, NULL, run_utf8_insert, undo_utf8_insert },
+	{ "utf8_remove", 1, true, true, setup_utf8_remove, run_utf8_remove, NULL },
+
+	{ "utf8_buf_reserve", 0, false, false, NULL, run_utf8_buf_reserve, NULL },
+	{ "utf8_buf_index", 1, false, false, NULL, run_utf8_buf_index, NULL },
+	{ "utf8_buf_rune_to_byte_index", 0, true, false, NULL, run_utf8_buf_rune_to_byte_index, NULL },
+	{ "utf8_buf_runes_from_left", 1, true, false, NULL, run_utf8_buf_runes_from_left, free_results },
+	{ "utf8_buf_append", 0, false, true, NULL, run_utf8_buf_append, undo_utf8_buf_append },
+	{ "utf8_buf_prepend", 1, false, true, NULL, run_utf8_buf_prepend, undo_utf8_buf_prepend },
+	{ "utf8_buf_insert", 1, true, true, NULL, run_utf8_buf_insert, undo_utf8_buf_insert },
+	{ "utf8_buf_remove", 1, true, true, setup_utf8_buf_remove, run_utf8_buf_remove, NULL },
+	{ "utf8_buf_free", 0, false, false, fill_utf8_bufs, run_utf8_buf_free, NULL },
+};
+
+// Builds a text of size runes of the script, edited at the position
+static void
+fixture_create(bench_fixture* f, const bench_script* script, size_t size, double at)
+{
+	const char* sample = script->sample;
+	size_t sample_len = strlen(sample);
+
+	f->size = size;
+	f->index = (size_t) (size * at);
+	f->codepoint = utf8_decode(sample, &f->piece_len);
+	memcpy(f->piece, sample, f->piece_len);
+	f->piece[f->piece_len] = '\0';
+
+	// Long enough for size runes of single bytes up to size runes of four
+	f->str = malloc(size * 4 + 1);
+	f->len = 0;
+	size_t offset = 0;
+	for (size_t i = 0; i < size; i++) {
+		if (i == f->index) {
+			f->byte_index = f->len;
+		}
+		if (i == (f->index < size ? f->index : size - 1)) {
+			f->read_byte_index = f->len;
+		}
+
+		size_t rune_len = 0;
+		utf8_decode(&sample[offset], &rune_len);
+		memcpy(&f->str[f->len], &sample[offset], rune_len);
+		f->len += rune_len;
+		offset = (offset + rune_len) % sample_len;
+	}
+	f->str[f->len] = '\0';
+	if (f->index == size) {
+		f->byte_index = f->len;
+	}
+
+	f->codepoints = malloc(f->len * sizeof(uint32_t));
+	f->glyphs = glyph_append(NULL, f->str);
+
+	f->buf = (utf8_buf){ 0 };
+	utf8_buf_append(&f->buf, f->str);
+	utf8_buf_index(&f->buf);
+}
+
+static void
+fixture_free(bench_fixture* f)
+{
+	free(f->str);
+	free(f->codepoints);
+	glyph_free(f->glyphs);
+	utf8_buf_free(&f->buf);
+}
+
+static int
+compare_doubles(const void* a, const void* b)
+{
+	double x = *(const double*) a;
+	double y = *(const double*) b;
+	return x < y ? -1 : x > y;
+}
+
+// Times the op on the fixture, returns the median round in ns per op and
+// writes the allocations per op
+static double
+bench_measure(const bench_op* op, bench_fixture* f, double* allocs_per_op)
+{
+	size_t reps = BENCH_MAX_REPS;
+	if (op->order > 0) {
+		reps = BENCH_LINEAR_WORK / f->size;
+	}
+	if (op->grows && reps > f->size / 4) {
+		reps = f->size / 4;
+	}
+	if (reps < 1) {
+		reps = 1;
+	} else if (reps > BENCH_MAX_REPS) {
+		reps = BENCH_MAX_REPS;
+	}
+
+	double rounds[BENCH_ROUNDS];
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		double seconds = 0;
+		size_t round_ops = 0;
+		size_t round_allocs = 0;
+
+		// Ops that edit the text are run in batches of reps, undone between
+		// batches so the text stays the size it is measured at
+		while (seconds < BENCH_ROUND_SECONDS) {
+			if (op->setup) {
+				op->setup(f, reps);
+			}
+
+			size_t allocs_before = allocs;
+			double start = bench_seconds();
+			op->run(f, reps);
+			seconds += bench_seconds() - start;
+			round_allocs += allocs - allocs_before;
+			round_ops += reps;
+
+			if (op->teardown) {
+				op->teardown(f, reps);
+			}
+		}
+
+		rounds[r] = seconds * 1e9 / round_ops;
+		*allocs_per_op = (double) round_allocs / round_ops;
+	}
+
+	qsort(rounds, BENCH_ROUNDS, sizeof(double), compare_doubles);
+	return rounds[BENCH_ROUNDS / 2];
+}
+
+// Returns the power of the size the cost grows with, as the slope of a least
+// squares line through the costs against the sizes on log scales
+static double
+fit_growth(const size_t* sizes, const double* ns, size_t count)
+{
+	double mean_x = 0;
+	double mean_y = 0;
+	for (size_t i = 0; i < count; i++) {
+		mean_x += log((double) sizes[i]) / count;
+		mean_y += log(ns[i]) / count;
+	}
+
+	double covariance = 0;
+	double variance = 0;
+	for (size_t i = 0; i < count; i++) {
+		double dx = log((double) sizes[i]) - mean_x;
+		covariance += dx * (log(ns[i]) - mean_y);
+		variance += dx * dx;
+	}
+
+	return variance > 0 ? covariance / variance : 0;
+}
+
+// Returns if the name is in the comma separated list, or there is no list
+static bool
+selected(const char* list, const char* name)
+{
+	if (!list) {
+		return true;
+	}
+
+	size_t len = strlen(name);
+	for (const char* p = list; *p;) {
+		size_t item = strcspn(p, ",");
+		if (item == len && strncmp(p, name, len) == 0) {
+			return true;
+		}
+		p += item + (p[item] == ',');
+	}
+	return false;
+}
+
+// Returns if the op is named, or starts with a name, on the command line
+static bool
+op_selected(const char* name, int count, char** names)
+{
+	if (count == 0) {
+		return true;
+	}
+
+	for (int i = 0; i < count; i++) {
+		if (strncmp(name, names[i], strlen(names[i])) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void
+usage(const char* bin)
+{
+	fprintf(stderr, "Usage: %s [-n <sizes>] [-s <scripts>] [-p <positions>] [op or op prefix...]\n", bin);
+	fprintf(stderr, "  sizes in runes, scripts ascii,latin,cjk,emoji, positions start,middle,end\n");
+}
+
+int
+main(int argc, char* argv[])
+{
+	size_t sizes[BENCH_MAX_SIZES];
+	size_t size_count = 0;
+	const char* script_list = NULL;
+	const char* position_list = NULL;
+
+	int first_op = 1;
+	for (; first_op < argc && argv[first_op][0] == '-'; first_op += 2) {
+		if (first_op + 1 >= argc) {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+
+		const char* value = argv[first_op + 1];
+		if (strcmp(argv[first_op], "-n") == 0) {
+			for (char* p = (char*) value; *p && size_count < BENCH_MAX_SIZES;) {
+				size_t size = strtoul(p, &p, 10);
+				if (size < 4) {
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				sizes[size_count++] = size;
+				p += *p == ',';
+			}
+		} else if (strcmp(argv[first_op], "-s") == 0) {
+			script_list = value;
+		} else if (strcmp(argv[first_op], "-p") == 0) {
+			position_list = value;
+		} else {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (size_count == 0) {
+		size_count = sizeof(default_sizes) / sizeof(default_sizes[0]);
+		memcpy(sizes, default_sizes, sizeof(default_sizes));
+	}
+
+	glyph_set_measure(measure_glyph);
+
+	printf("kernel: %s, median of %d rounds of at least %.0f ms\n", utf8_kernel_name(), BENCH_ROUNDS, BENCH_ROUND_SECONDS * 1000);
+	printf("%-28s %-6s %-8s %8s %12s %10s\n", "op", "script", "position", "size", "ns/op", "allocs/op");
+
+	bench_fixture* f = calloc(1, sizeof(bench_fixture));
+	int flagged = 0;
+
+	for (size_t o = 0; o < sizeof(ops) / sizeof(ops[0]); o++) {
+		const bench_op* op = &ops[o];
+		if (!op_selected(op->name, argc - first_op, &argv[first_op])) {
+			continue;
+		}
+
+		for (size_t s = 0; s < bench_script_count; s++) {
+			if (!selected(script_list, bench_scripts[s].name)) {
+				continue;
+			}
+
+			for (size_t p = 0; p < sizeof(positions) / sizeof(positions[0]); p++) {
+				// Ops that don't take a position run once, at the end
+				if (!op->positional && p != sizeof(positions) / sizeof(positions[0]) - 1) {
+					continue;
+				}
+				if (op->positional && !selected(position_list, positions[p].name)) {
+					continue;
+				}
+
+				double ns[BENCH_MAX_SIZES];
+				for (size_t n = 0; n < size_count; n++) {
+					fixture_create(f, &bench_scripts[s], sizes[n], positions[p].at);
+					double allocs_per_op = 0;
+					ns[n] = bench_measure(op, f, &allocs_per_op);
+					fixture_free(f);
+
+					printf("%-28s %-6s %-8s %8zu %12.1f %10.2f\n", op->name, bench_scripts[s].name,
+						op->positional ? positions[p].name : "-", sizes[n], ns[n], allocs_per_op);
+				}
+
+				// A cost per op growing a power of the size faster than it
+				// should means a run of them is quadratic, or worse
+				double growth = fit_growth(sizes, ns, size_count);
+				if (size_count > 1 && growth > op->order + BENCH_SLACK) {
+					printf("  QUADRATIC: %s %s %s grows as n^%.1f per op, expected n^%d\n", op->name, bench_scripts[s].name,
+						op->positional ? positions[p].name : "-", growth, op->order);
+					flagged++;
+				}
+			}
+		}
+	}
+
+	free(f);
+
+	if (flagged > 0) {
+		printf("%d suspected quadratic\n", flagged);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -1,9 +1,10 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdlib.h>
-#include <stdio.h>
 #include <string.h>
 
+#include "utf8.h"
+
 // Copied from musl libc
 static char*
 utf8_strdup(const char* str)
@@ -47,6 +48,27 @@ utf8_strndup(const char* str, size_t n)
 	return dest;
 }
 
+// Returns the count of bytes making up rune_count runes from the byte index
+static size_t
+utf8_rune_span(const char* str, const size_t byte_index, const size_t byte_size, const size_t rune_count)
+{
+	size_t bytes = 0;
+	size_t remaining_runes = rune_count + 1;
+	for (size_t i = byte_index; i < byte_size; i++) {
+		if (utf8_is_rune_start(str[i])) {
+			remaining_runes--;
+
+			if (remaining_runes == 0) {
+				break;
+			}
+		}
+
+		bytes++;
+	}
+
+	return bytes;
+}
+
 char*
 utf8_from_literal(const char* str)
 {
@@ -60,6 +82,520 @@ utf8_is_rune_start(const char ch)
 	return (ch & 0xC0) != 0x80;
 }
 
+// Decodes the rune at the start of s without reading past avail bytes
+static uint32_t
+utf8_decode_bounded(const unsigned char* s, size_t avail, size_t* len)
+{
+	uint32_t codepoint = 0xFFFD;
+	unsigned char lo = 0x80;
+	unsigned char hi = 0xBF;
+	size_t expect = 0;
+
+	*len = 1;
+
+	// Same ranges as utf8_valid_rune_len, so overlongs, surrogates and runes
+	// past U+10FFFF decode to U+FFFD rather than what they spell
+	if (s[0] < 0x80) {
+		return s[0];
+	} else if (s[0] >= 0xC2 && s[0] <= 0xDF) {
+		codepoint = s[0] & 0x1F;
+		expect = 1;
+	} else if (s[0] >= 0xE0 && s[0] <= 0xEF) {
+		codepoint = s[0] & 0x0F;
+		expect = 2;
+		lo = s[0] == 0xE0 ? 0xA0 : 0x80;
+		hi = s[0] == 0xED ? 0x9F : 0xBF;
+	} else if (s[0] >= 0xF0 && s[0] <= 0xF4) {
+		codepoint = s[0] & 0x07;
+		expect = 3;
+		lo = s[0] == 0xF0 ? 0x90 : 0x80;
+		hi = s[0] == 0xF4 ? 0x8F : 0xBF;
+	} else {
+		return 0xFFFD;
+	}
+
+	for (size_t i = 1; i <= expect; i++) {
+		if (i >= avail || (s[i] & 0xC0) != 0x80 || (i == 1 && (s[i] < lo || s[i] > hi))) {
+			return 0xFFFD;
+		}
+		codepoint = (codepoint << 6) | (s[i] & 0x3F);
+		(*len)++;
+	}
+
+	return codepoint;
+}
+
+/*
+ * Rune counting and validation kernels. Rune starts are counted 16 or 32
+ * bytes at a time by comparing against the continuation byte range. The SSE2
+ * validator skips whole blocks of ASCII and walks the rest a rune at a time,
+ * while the AVX2 validator checks every block with nibble lookup tables
+ * (Keiser & Lemire, "Validating UTF-8 In Less Than One Instruction Per Byte").
+ * Decoding widens blocks of ASCII straight to codepoints and decodes the rest
+ * a rune at a time. The widest kernel the CPU supports is picked on first use.
+ */
+
+typedef size_t (*utf8_count_fn)(const unsigned char* s, size_t len);
+typedef bool (*utf8_validate_fn)(const unsigned char* s, size_t len, size_t* runes);
+typedef size_t (*utf8_decode_fn)(const unsigned char* s, size_t len, uint32_t* out);
+
+// Returns the length of the well formed rune at the start of s, or 0
+static size_t
+utf8_valid_rune_len(const unsigned char* s, size_t len)
+{
+	unsigned char lo = 0x80;
+	unsigned char hi = 0xBF;
+	size_t need = 0;
+
+	if (s[0] < 0x80) {
+		return 1;
+	} else if (s[0] >= 0xC2 && s[0] <= 0xDF) {
+		need = 1;
+	} else if (s[0] == 0xE0) {
+		// Overlong
+		need = 2;
+		lo = 0xA0;
+	} else if (s[0] == 0xED) {
+		// Surrogates
+		need = 2;
+		hi = 0x9F;
+	} else if (s[0] >= 0xE1 && s[0] <= 0xEF) {
+		need = 2;
+	} else if (s[0] == 0xF0) {
+		// Overlong
+		need = 3;
+		lo = 0x90;
+	} else if (s[0] >= 0xF1 && s[0] <= 0xF3) {
+		need = 3;
+	} else if (s[0] == 0xF4) {
+		// Past U+10FFFF
+		need = 3;
+		hi = 0x8F;
+	} else {
+		return 0;
+	}
+
+	if (len <= need || s[1] < lo || s[1] > hi) {
+		return 0;
+	}
+
+	for (size_t i = 2; i <= need; i++) {
+		if ((s[i] & 0xC0) != 0x80) {
+			return 0;
+		}
+	}
+
+	return need + 1;
+}
+
+static size_t
+utf8_count_scalar(const unsigned char* s, size_t len)
+{
+	size_t runes = 0;
+	for (size_t i = 0; i < len; i++) {
+		runes += (s[i] & 0xC0) != 0x80;
+	}
+	return runes;
+}
+
+static bool
+utf8_validate_scalar(const unsigned char* s, size_t len, size_t* runes)
+{
+	size_t count = 0;
+	for (size_t i = 0; i < len; count++) {
+		size_t rune_len = utf8_valid_rune_len(&s[i], len - i);
+		if (rune_len == 0) {
+			return false;
+		}
+		i += rune_len;
+	}
+
+	*runes = count;
+	return true;
+}
+
+static size_t
+utf8_decode_scalar(const unsigned char* s, size_t len, uint32_t* out)
+{
+	size_t count = 0;
+	for (size_t i = 0; i < len; count++) {
+		size_t rune_len = 0;
+		out[count] = utf8_decode_bounded(&s[i], len - i, &rune_len);
+		i += rune_len;
+	}
+	return count;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+
+#define UTF8_HAVE_X86
+
+__attribute__((target("sse2")))
+static size_t
+utf8_count_sse2(const unsigned char* s, size_t len)
+{
+	// Rune starts are the bytes that are signed greater than 0xBF (-65)
+	const __m128i last_continuation = _mm_set1_epi8(-65);
+	size_t runes = 0;
+	size_t i = 0;
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*) &s[i]);
+		unsigned mask = _mm_movemask_epi8(_mm_cmpgt_epi8(v, last_continuation));
+		runes += __builtin_popcount(mask);
+	}
+
+	return runes + utf8_count_scalar(&s[i], len - i);
+}
+
+__attribute__((target("sse2")))
+static bool
+utf8_validate_sse2(const unsigned char* s, size_t len, size_t* runes)
+{
+	size_t count = 0;
+	size_t i = 0;
+
+	while (i < len) {
+		// The top bit of every byte is clear in an all ASCII block
+		if (i + 16 <= len && _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) &s[i])) == 0) {
+			i += 16;
+			count += 16;
+			continue;
+		}
+
+		// Otherwise walk runes until the next block starts
+		size_t block_end = i + 16;
+		while (i < block_end && i < len) {
+			size_t rune_len = utf8_valid_rune_len(&s[i], len - i);
+			if (rune_len == 0) {
+				return false;
+			}
+			i += rune_len;
+			count++;
+		}
+	}
+
+	*runes = count;
+	return true;
+}
+
+__attribute__((target("sse2")))
+static size_t
+utf8_decode_sse2(const unsigned char* s, size_t len, uint32_t* out)
+{
+	const __m128i zero = _mm_setzero_si128();
+	size_t count = 0;
+	size_t i = 0;
+
+	while (i < len) {
+		if (i + 16 <= len) {
+			__m128i v = _mm_loadu_si128((const __m128i*) &s[i]);
+
+			// Widen a block of ASCII straight to codepoints
+			if (_mm_movemask_epi8(v) == 0) {
+				__m128i lo = _mm_unpacklo_epi8(v, zero);
+				__m128i hi = _mm_unpackhi_epi8(v, zero);
+				_mm_storeu_si128((__m128i*) &out[count], _mm_unpacklo_epi16(lo, zero));
+				_mm_storeu_si128((__m128i*) &out[count + 4], _mm_unpackhi_epi16(lo, zero));
+				_mm_storeu_si128((__m128i*) &out[count + 8], _mm_unpacklo_epi16(hi, zero));
+				_mm_storeu_si128((__m128i*) &out[count + 12], _mm_unpackhi_epi16(hi, zero));
+				i += 16;
+				count += 16;
+				continue;
+			}
+		}
+
+		size_t block_end = i + 16;
+		while (i < block_end && i < len) {
+			size_t rune_len = 0;
+			out[count++] = utf8_decode_bounded(&s[i], len - i, &rune_len);
+			i += rune_len;
+		}
+	}
+
+	return count;
+}
+
+__attribute__((target("avx2")))
+static size_t
+utf8_count_avx2(const unsigned char* s, size_t len)
+{
+	const __m256i last_continuation = _mm256_set1_epi8(-65);
+	size_t runes = 0;
+	size_t i = 0;
+
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*) &s[i]);
+		unsigned mask = (unsigned) _mm256_movemask_epi8(_mm256_cmpgt_epi8(v, last_continuation));
+		runes += __builtin_popcount(mask);
+	}
+
+	return runes + utf8_count_sse2(&s[i], len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t
+utf8_decode_avx2(const unsigned char* s, size_t len, uint32_t* out)
+{
+	size_t count = 0;
+	size_t i = 0;
+
+	while (i < len) {
+		if (i + 32 <= len) {
+			__m256i v = _mm256_loadu_si256((const __m256i*) &s[i]);
+
+			// Widen a block of ASCII straight to codepoints, 8 at a time
+			if (_mm256_movemask_epi8(v) == 0) {
+				for (size_t b = 0; b < 32; b += 8) {
+					__m128i bytes = _mm_loadl_epi64((const __m128i*) &s[i + b]);
+					_mm256_storeu_si256((__m256i*) &out[count + b], _mm256_cvtepu8_epi32(bytes));
+				}
+				i += 32;
+				count += 32;
+				continue;
+			}
+		}
+
+		size_t block_end = i + 32;
+		while (i < block_end && i < len) {
+			size_t rune_len = 0;
+			out[count++] = utf8_decode_bounded(&s[i], len - i, &rune_len);
+			i += rune_len;
+		}
+	}
+
+	return count;
+}
+
+// Error bits of the lookup tables
+#define UTF8_TOO_SHORT  (1 << 0)
+#define UTF8_TOO_LONG   (1 << 1)
+#define UTF8_OVERLONG_3 (1 << 2)
+#define UTF8_TOO_LARGE  (1 << 3)
+#define UTF8_SURROGATE  (1 << 4)
+#define UTF8_OVERLONG_2 (1 << 5)
+#define UTF8_TOO_LARGE_1000 (1 << 6)
+#define UTF8_OVERLONG_4 (1 << 6)
+#define UTF8_TWO_CONTS  (1 << 7)
+#define UTF8_CARRY (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+// Repeats a 16 entry table in both lanes for _mm256_shuffle_epi8
+#define UTF8_TABLE(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+
+__attribute__((target("avx2")))
+static __m256i
+utf8_prev_avx2(__m256i input, __m256i prev_input, const int n)
+{
+	// Bytes of input shifted along by n, pulling in the end of prev_input
+	__m256i spliced = _mm256_permute2x128_si256(prev_input, input, 0x21);
+	switch (n) {
+		case 1: return _mm256_alignr_epi8(input, spliced, 15);
+		case 2: return _mm256_alignr_epi8(input, spliced, 14);
+		default: return _mm256_alignr_epi8(input, spliced, 13);
+	}
+}
+
+__attribute__((target("avx2")))
+static __m256i
+utf8_block_errors_avx2(__m256i input, __m256i prev_input)
+{
+	const __m256i nibble = _mm256_set1_epi8(0x0F);
+
+	const __m256i byte_1_high_table = UTF8_TABLE(
+		// ASCII in byte 1
+		UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+		UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+		// Continuation in byte 1
+		UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+		// Two byte lead in byte 1
+		UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+		UTF8_TOO_SHORT,
+		// Three byte lead in byte 1
+		UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+		// Four byte lead in byte 1
+		UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4
+	);
+
+	const __m256i byte_1_low_table = UTF8_TABLE(
+		UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+		UTF8_CARRY | UTF8_OVERLONG_2,
+		UTF8_CARRY,
+		UTF8_CARRY,
+		UTF8_CARRY | UTF8_TOO_LARGE,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+		UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000
+	);
+
+	const __m256i byte_2_high_table = UTF8_TABLE(
+		// ASCII in byte 2
+		UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+		UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+		// Continuation in byte 2
+		UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+		UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,
+		UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+		UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+		// Lead in byte 2
+		UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT
+	);
+
+	__m256i prev1 = utf8_prev_avx2(input, prev_input, 1);
+	__m256i byte_1_high = _mm256_shuffle_epi8(byte_1_high_table, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+	__m256i byte_1_low = _mm256_shuffle_epi8(byte_1_low_table, _mm256_and_si256(prev1, nibble));
+	__m256i byte_2_high = _mm256_shuffle_epi8(byte_2_high_table, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+	__m256i special = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+	// Third and fourth bytes of a rune must be continuations
+	__m256i prev2 = utf8_prev_avx2(input, prev_input, 2);
+	__m256i prev3 = utf8_prev_avx2(input, prev_input, 3);
+	__m256i is_third = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char) (0xE0 - 1)));
+	__m256i is_fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char) (0xF0 - 1)));
+	__m256i must_continue = _mm256_cmpgt_epi8(_mm256_or_si256(is_third, is_fourth), _mm256_setzero_si256());
+	__m256i must_continue_80 = _mm256_and_si256(must_continue, _mm256_set1_epi8((char) 0x80));
+
+	return _mm256_xor_si256(must_continue_80, special);
+}
+
+__attribute__((target("avx2")))
+static __m256i
+utf8_incomplete_avx2(__m256i input)
+{
+	// Nonzero where a lead byte at the end of the block still needs bytes
+	const __m256i max_value = _mm256_setr_epi8(
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		(char) (0xF0 - 1), (char) (0xE0 - 1), (char) (0xC0 - 1)
+	);
+	return _mm256_subs_epu8(input, max_value);
+}
+
+__attribute__((target("avx2")))
+static bool
+utf8_validate_avx2(const unsigned char* s, size_t len, size_t* runes)
+{
+	const __m256i last_continuation = _mm256_set1_epi8(-65);
+	__m256i error = _mm256_setzero_si256();
+	__m256i prev_input = _mm256_setzero_si256();
+	__m256i prev_incomplete = _mm256_setzero_si256();
+	size_t count = 0;
+	size_t i = 0;
+
+	for (; i + 32 <= len; i += 32) {
+		__m256i input = _mm256_loadu_si256((const __m256i*) &s[i]);
+		count += __builtin_popcount((unsigned) _mm256_movemask_epi8(_mm256_cmpgt_epi8(input, last_continuation)));
+
+		if (_mm256_movemask_epi8(input) == 0) {
+			// ASCII is only an error if the last block ended mid rune
+			error = _mm256_or_si256(error, prev_incomplete);
+		} else {
+			error = _mm256_or_si256(error, utf8_block_errors_avx2(input, prev_input));
+			prev_incomplete = utf8_incomplete_avx2(input);
+		}
+		prev_input = input;
+	}
+
+	// Zero pad the tail, the padding is ASCII which catches truncated runes
+	if (i < len) {
+		unsigned char tail[32] = { 0 };
+		memcpy(tail, &s[i], len - i);
+		count += utf8_count_scalar(&s[i], len - i);
+
+		__m256i input = _mm256_loadu_si256((const __m256i*) tail);
+		error = _mm256_or_si256(error, utf8_block_errors_avx2(input, prev_input));
+		prev_incomplete = utf8_incomplete_avx2(input);
+	}
+
+	error = _mm256_or_si256(error, prev_incomplete);
+
+	*runes = count;
+	return _mm256_testz_si256(error, error);
+}
+#endif
+
+static utf8_count_fn utf8_count_kernel = NULL;
+static utf8_validate_fn utf8_validate_kernel = NULL;
+static utf8_decode_fn utf8_decode_kernel = NULL;
+static const char* utf8_kernel = "scalar";
+
+static void
+utf8_pick_kernels(void)
+{
+	utf8_count_kernel = utf8_count_scalar;
+	utf8_validate_kernel = utf8_validate_scalar;
+	utf8_decode_kernel = utf8_decode_scalar;
+
+#ifdef UTF8_HAVE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		utf8_count_kernel = utf8_count_avx2;
+		utf8_validate_kernel = utf8_validate_avx2;
+		utf8_decode_kernel = utf8_decode_avx2;
+		utf8_kernel = "avx2";
+	} else if (__builtin_cpu_supports("sse2")) {
+		utf8_count_kernel = utf8_count_sse2;
+		utf8_validate_kernel = utf8_validate_sse2;
+		utf8_decode_kernel = utf8_decode_sse2;
+		utf8_kernel = "sse2";
+	}
+#endif
+}
+
+const char*
+utf8_kernel_name(void)
+{
+	if (!utf8_count_kernel) {
+		utf8_pick_kernels();
+	}
+
+	return utf8_kernel;
+}
+
+size_t
+utf8_rune_count_n(const char* str, size_t len)
+{
+	if (str == NULL) {
+		return 0;
+	}
+
+	if (!utf8_count_kernel) {
+		utf8_pick_kernels();
+	}
+
+	return utf8_count_kernel((const unsigned char*) str, len);
+}
+
+bool
+utf8_validate(const char* str, size_t len, size_t* runes)
+{
+	size_t count = 0;
+
+	if (str == NULL) {
+		len = 0;
+	}
+
+	if (!utf8_validate_kernel) {
+		utf8_pick_kernels();
+	}
+
+	bool valid = len == 0 || utf8_validate_kernel((const unsigned char*) str, len, &count);
+
+	if (runes) {
+		*runes = valid ? count : 0;
+	}
+
+	return valid;
+}
+
 size_t
 utf8_rune_count(const char* str)
 {
@@ -67,14 +603,87 @@ utf8_rune_count(const char* str)
 		return 0;
 	}
 
-	int runes = 0;
-	size_t len = strlen(str);
-	for (size_t i = 0; i < len; i++) {
-		if (utf8_is_rune_start(str[i])) {
-			runes++;
+	return utf8_rune_count_n(str, strlen(str));
+}
+
+uint32_t
+utf8_decode(const char* str, size_t* len)
+{
+	// The terminator stops a truncated rune like any other non continuation
+	size_t bytes = 0;
+	uint32_t codepoint = utf8_decode_bounded((const unsigned char*) str, SIZE_MAX, &bytes);
+
+	if (len) {
+		*len = bytes;
+	}
+
+	return codepoint;
+}
+
+size_t
+utf8_decode_n(const char* str, size_t len, uint32_t* out)
+{
+	if (str == NULL) {
+		return 0;
+	}
+
+	if (!utf8_decode_kernel) {
+		utf8_pick_kernels();
+	}
+
+	return utf8_decode_kernel((const unsigned char*) str, len, out);
+}
+
+size_t
+utf8_encode(uint32_t codepoint, char* out)
+{
+	// Surrogates and out of range codepoints can't be encoded
+	if ((codepoint >= 0xD800 && codepoint <= 0xDFFF) || codepoint > 0x10FFFF) {
+		codepoint = 0xFFFD;
+	}
+
+	size_t len = 4;
+	if (codepoint < 0x80) {
+		len = 1;
+	} else if (codepoint < 0x800) {
+		len = 2;
+	} else if (codepoint < 0x10000) {
+		len = 3;
+	}
+
+	if (!out) {
+		return len;
+	}
+
+	switch (len) {
+		case 1: {
+			out[0] = (char) codepoint;
+			break;
+		}
+
+		case 2: {
+			out[0] = (char) (0xC0 | (codepoint >> 6));
+			out[1] = (char) (0x80 | (codepoint & 0x3F));
+			break;
+		}
+
+		case 3: {
+			out[0] = (char) (0xE0 | (codepoint >> 12));
+			out[1] = (char) (0x80 | ((codepoint >> 6) & 0x3F));
+			out[2] = (char) (0x80 | (codepoint & 0x3F));
+			break;
+		}
+
+		case 4: {
+			out[0] = (char) (0xF0 | (codepoint >> 18));
+			out[1] = (char) (0x80 | ((codepoint >> 12) & 0x3F));
+			out[2] = (char) (0x80 | ((codepoint >> 6) & 0x3F));
+			out[3] = (char) (0x80 | (codepoint & 0x3F));
+			break;
 		}
 	}
-	return runes;
+
+	return len;
 }
 
 char*
@@ -92,16 +701,14 @@ utf8_append(char* dest, const char* src)
 char*
 utf8_prepend(char* dest, const char* src)
 {
-	char* after = utf8_strdup(dest);
-	size_t after_size = strlen(after);
-
-	const char* before = src;
-	size_t before_size = strlen(before);
+	size_t dest_size = strlen(dest);
+	size_t src_size = strlen(src);
 
-	dest = (char*) realloc(dest, before_size + after_size + 1);
-	sprintf(dest, "%s%s", before, after);
+	dest = (char*) realloc(dest, src_size + dest_size + 1);
 
-	free(after);
+	// shift dest along in place and copy src in front of it
+	memmove(dest + src_size, dest, dest_size + 1);
+	memcpy(dest, src, src_size);
 
 	return dest;
 }
@@ -159,27 +766,15 @@ utf8_insert(char* dest, const size_t rune_index, const char* src)
 
 	// find byte index at point to insert
 	size_t byte_index = utf8_rune_to_byte_index(dest, rune_index);
+	size_t dest_size = strlen(dest);
+	size_t src_size = strlen(src);
 
-	// split dest into before and after the byte index point
-	char* before = utf8_strndup(dest, byte_index);
-	size_t before_size = strlen(before);
-
-	char* after = utf8_strdup(dest + byte_index);
-	size_t after_size = strlen(after);
-
-	// make the new string the middle
-	const char* middle = src;
-	size_t middle_size = strlen(middle);
-
-	// resize dest to account for middle
-	dest = (char*) realloc(dest, before_size + middle_size + after_size + 1);
+	// resize dest to account for src
+	dest = (char*) realloc(dest, dest_size + src_size + 1);
 
-	// shove before, middle, after into dest
-	sprintf(dest, "%s%s%s", before, middle, after);
-
-	// free temp before and after
-	free(before);
-	free(after);
+	// open a gap at the byte index and copy src into it
+	memmove(dest + byte_index + src_size, dest + byte_index, dest_size - byte_index + 1);
+	memcpy(dest + byte_index, src, src_size);
 
 	return dest;
 }
@@ -203,42 +798,283 @@ utf8_remove(char* dest, const size_t rune_index, const size_t rune_count)
 	size_t byte_index = utf8_rune_to_byte_index(dest, rune_index);
 
 	// find amount of bytes to remove from the byte index onwards
-	size_t bytes_to_remove = 0;
 	size_t byte_size = strlen(dest);
-	size_t remaining_runes = rune_count + 1;
-	for (size_t i = byte_index; i < byte_size; i++) {
-		if (utf8_is_rune_start(dest[i])) {
-			remaining_runes--;
+	size_t bytes_to_remove = utf8_rune_span(dest, byte_index, byte_size, rune_count);
 
-			if (remaining_runes == 0) {
-				break;
-			}
+	// close the gap in place, the allocation is left as is
+	memmove(dest + byte_index, dest + byte_index + bytes_to_remove, byte_size - byte_index - bytes_to_remove + 1);
+
+	// zero length string is useless
+	if (dest[0] == '\0') {
+		free(dest);
+		return NULL;
+	}
+
+	return dest;
+}
+
+// Smallest capacity a utf8_buf grows to
+#define UTF8_BUF_MIN_CAP 16
+
+bool
+utf8_buf_reserve(utf8_buf* buf, const size_t len)
+{
+	if (len + 1 <= buf->cap) {
+		return true;
+	}
+
+	// grow geometrically so a run of edits reallocates O(log n) times
+	size_t cap = buf->cap * 2;
+	if (cap < len + 1) {
+		cap = len + 1;
+	}
+	if (cap < UTF8_BUF_MIN_CAP) {
+		cap = UTF8_BUF_MIN_CAP;
+	}
+
+	char* data = (char*) realloc(buf->data, cap);
+	if (!data) {
+		return false;
+	}
+
+	if (!buf->data) {
+		data[0] = '\0';
+	}
+
+	buf->data = data;
+	buf->cap = cap;
+	return true;
+}
+
+// Skips forward from a checkpoint to the byte offset of the rune index
+static size_t
+utf8_buf_scan(utf8_buf* buf, size_t rune, size_t byte, const size_t rune_index)
+{
+	while (rune < rune_index && byte < buf->len) {
+		byte++;
+		while (byte < buf->len && !utf8_is_rune_start(buf->data[byte])) {
+			byte++;
+		}
+		rune++;
+	}
+
+	return byte;
+}
+
+static bool
+utf8_buf_reserve_checkpoints(utf8_buf* buf, const size_t count)
+{
+	if (count <= buf->checkpoint_cap) {
+		return true;
+	}
+
+	size_t cap = buf->checkpoint_cap * 2;
+	if (cap < count) {
+		cap = count;
+	}
+
+	utf8_checkpoint* checkpoints = realloc(buf->checkpoints, cap * sizeof(utf8_checkpoint));
+	if (!checkpoints) {
+		return false;
+	}
+
+	buf->checkpoints = checkpoints;
+	buf->checkpoint_cap = cap;
+	return true;
+}
+
+// Returns the position of the last checkpoint at or before the byte offset
+static size_t
+utf8_buf_checkpoint_at_byte(utf8_buf* buf, const size_t byte)
+{
+	size_t lo = 0;
+	size_t hi = buf->checkpoint_count;
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (buf->checkpoints[mid].byte <= byte) {
+			lo = mid;
+		} else {
+			hi = mid;
 		}
+	}
+	return lo;
+}
 
-		bytes_to_remove++;
+/*
+ * Fills in checkpoints between checkpoint i and the next one (or the end of
+ * the string) wherever they are more than twice the spacing apart.
+ */
+static void
+utf8_buf_fill_checkpoints(utf8_buf* buf, const size_t i)
+{
+	bool last = i + 1 >= buf->checkpoint_count;
+	if (!last && buf->checkpoints[i + 1].rune - buf->checkpoints[i].rune <= 2 * UTF8_CHECKPOINT_RUNES) {
+		return;
 	}
 
-	// take chars before the byte index
-	char* before = utf8_strndup(dest, byte_index);
-	size_t before_size = strlen(before);
+	size_t end = last ? buf->len : buf->checkpoints[i + 1].byte;
+	size_t rune = buf->checkpoints[i].rune;
+	size_t byte = buf->checkpoints[i].byte;
+	size_t at = i + 1;
 
-	// take cahrs after the bytes index and the addition bytes to remove
-	char* after = utf8_strdup(dest + byte_index + bytes_to_remove);
-	size_t after_size = strlen(after);
+	for (;;) {
+		byte = utf8_buf_scan(buf, rune, byte, rune + UTF8_CHECKPOINT_RUNES);
+		rune += UTF8_CHECKPOINT_RUNES;
 
-	// resize and insert
-	dest = (char*) realloc(dest, before_size + after_size + 1);
-	sprintf(dest, "%s%s", before, after);
+		// Leave the final stretch up to the next checkpoint longer instead of tiny
+		if (byte >= end || (!last && buf->checkpoints[at].rune - rune < UTF8_CHECKPOINT_RUNES)) {
+			break;
+		}
 
-	// free temp variables
-	free(before);
-	free(after);
+		if (!utf8_buf_reserve_checkpoints(buf, buf->checkpoint_count + 1)) {
+			return;
+		}
 
-	// zero length string is useless
-	if (dest[0] == '\0') {
-		free(dest);
-		return NULL;
+		memmove(&buf->checkpoints[at + 1], &buf->checkpoints[at], (buf->checkpoint_count - at) * sizeof(utf8_checkpoint));
+		buf->checkpoints[at] = (utf8_checkpoint){ .rune = rune, .byte = byte };
+		buf->checkpoint_count++;
+		at++;
 	}
+}
 
-	return dest;
+/*
+ * Updates the checkpoints after remove_bytes holding removed_runes at the byte
+ * index were replaced with src_size bytes holding inserted_runes.
+ */
+static void
+utf8_buf_reindex(utf8_buf* buf, const size_t byte_index, const size_t remove_bytes, const size_t removed_runes, const size_t src_size, const size_t inserted_runes)
+{
+	size_t i = utf8_buf_checkpoint_at_byte(buf, byte_index);
+	size_t removed_end = byte_index + remove_bytes;
+
+	// Drop the checkpoints that pointed into the removed bytes
+	size_t next = i + 1;
+	while (next < buf->checkpoint_count && buf->checkpoints[next].byte < removed_end) {
+		next++;
+	}
+	memmove(&buf->checkpoints[i + 1], &buf->checkpoints[next], (buf->checkpoint_count - next) * sizeof(utf8_checkpoint));
+	buf->checkpoint_count -= next - (i + 1);
+
+	// Everything after the edit moved by the same amount
+	for (size_t c = i + 1; c < buf->checkpoint_count; c++) {
+		buf->checkpoints[c].rune = buf->checkpoints[c].rune - removed_runes + inserted_runes;
+		buf->checkpoints[c].byte = buf->checkpoints[c].byte - remove_bytes + src_size;
+	}
+
+	utf8_buf_fill_checkpoints(buf, i);
+}
+
+bool
+utf8_buf_index(utf8_buf* buf)
+{
+	if (!utf8_buf_reserve_checkpoints(buf, 1)) {
+		return false;
+	}
+
+	buf->indexed = true;
+	buf->checkpoints[0] = (utf8_checkpoint){ .rune = 0, .byte = 0 };
+	buf->checkpoint_count = 1;
+	utf8_buf_fill_checkpoints(buf, 0);
+
+	return true;
+}
+
+size_t
+utf8_buf_rune_to_byte_index(utf8_buf* buf, size_t rune_index)
+{
+	if (buf->len == 0) {
+		return 0;
+	}
+
+	if (!buf->indexed) {
+		return utf8_buf_scan(buf, 0, 0, rune_index);
+	}
+
+	// Binary search for the last checkpoint at or before the rune
+	size_t lo = 0;
+	size_t hi = buf->checkpoint_count;
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (buf->checkpoints[mid].rune <= rune_index) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return utf8_buf_scan(buf, buf->checkpoints[lo].rune, buf->checkpoints[lo].byte, rune_index);
+}
+
+char*
+utf8_buf_runes_from_left(utf8_buf* buf, size_t rune_index)
+{
+	if (buf->len == 0) {
+		return utf8_strdup("");
+	}
+
+	return utf8_strndup(buf->data, utf8_buf_rune_to_byte_index(buf, rune_index));
+}
+
+// Replaces remove_bytes from the byte index with src, entirely in place
+static bool
+utf8_buf_splice(utf8_buf* buf, const size_t byte_index, const size_t remove_bytes, const char* src, const size_t src_size)
+{
+	if (!utf8_buf_reserve(buf, buf->len - remove_bytes + src_size)) {
+		return false;
+	}
+
+	size_t removed_runes = 0;
+	if (buf->indexed) {
+		removed_runes = utf8_rune_count_n(buf->data + byte_index, remove_bytes);
+	}
+
+	size_t tail = buf->len - byte_index - remove_bytes;
+	memmove(buf->data + byte_index + src_size, buf->data + byte_index + remove_bytes, tail + 1);
+	memcpy(buf->data + byte_index, src, src_size);
+	buf->len = buf->len - remove_bytes + src_size;
+
+	if (buf->indexed) {
+		utf8_buf_reindex(buf, byte_index, remove_bytes, removed_runes, src_size, utf8_rune_count_n(src, src_size));
+	}
+
+	return true;
+}
+
+bool
+utf8_buf_append(utf8_buf* buf, const char* src)
+{
+	return utf8_buf_splice(buf, buf->len, 0, src, strlen(src));
+}
+
+bool
+utf8_buf_prepend(utf8_buf* buf, const char* src)
+{
+	return utf8_buf_splice(buf, 0, 0, src, strlen(src));
+}
+
+bool
+utf8_buf_insert(utf8_buf* buf, const size_t rune_index, const char* src)
+{
+	size_t byte_index = utf8_buf_rune_to_byte_index(buf, rune_index);
+	return utf8_buf_splice(buf, byte_index, 0, src, strlen(src));
+}
+
+void
+utf8_buf_remove(utf8_buf* buf, const size_t rune_index, const size_t rune_count)
+{
+	if (buf->len == 0 || rune_count < 1) {
+		return;
+	}
+
+	size_t byte_index = utf8_buf_rune_to_byte_index(buf, rune_index);
+	size_t bytes_to_remove = utf8_rune_span(buf->data, byte_index, buf->len, rune_count);
+	utf8_buf_splice(buf, byte_index, bytes_to_remove, "", 0);
+}
+
+void
+utf8_buf_free(utf8_buf* buf)
+{
+	free(buf->data);
+	free(buf->checkpoints);
+	*buf = (utf8_buf){ 0 };
 }
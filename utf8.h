@@ -1,4 +1,5 @@
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 /*
@@ -16,6 +17,43 @@ bool utf8_is_rune_start(const char ch);
  */
 size_t utf8_rune_count(const char* str);
 
+/*
+ * Returns the count of UTF8 runes in the first len bytes of the string.
+ */
+size_t utf8_rune_count_n(const char* str, size_t len);
+
+/*
+ * Returns if the first len bytes of the string are valid UTF8, counting the
+ * runes in the same pass. The count is written to runes if it is not NULL.
+ */
+bool utf8_validate(const char* str, size_t len, size_t* runes);
+
+/*
+ * Returns the name of the instruction set used to count, validate and decode
+ * runes.
+ */
+const char* utf8_kernel_name(void);
+
+/*
+ * Decodes the UTF8 rune at the start of the string into its codepoint.
+ * The byte length of the rune is written to len if it is not NULL.
+ * Malformed runes decode to U+FFFD.
+ */
+uint32_t utf8_decode(const char* str, size_t* len);
+
+/*
+ * Decodes the first len bytes of the string into codepoints, writing them to
+ * out, which needs room for len codepoints. Malformed runes decode to U+FFFD.
+ * Returns the count of codepoints written.
+ */
+size_t utf8_decode_n(const char* str, size_t len, uint32_t* out);
+
+/*
+ * Encodes the codepoint as a UTF8 rune into out, which needs room for 4 bytes.
+ * Returns the byte length of the rune. Nothing is written if out is NULL.
+ */
+size_t utf8_encode(uint32_t codepoint, char* out);
+
 /*
  * Appends the contents of src to dest.
  * Automatically resizes dest and returns it.
@@ -33,12 +71,12 @@ char* utf8_prepend(char* dest, const char* src);
  * Finds the byte offset corresponding to the given index of the UTF8 rune in
  * the string.
  */
-size_t utf8_rune_to_byte_index(char* str, size_t rune_index);
+size_t utf8_rune_to_byte_index(const char* str, size_t rune_index);
 
 /*
  * Returns a substring of runes from the string start.
  */
-char* utf8_runes_from_left(char* str, size_t rune_index);
+char* utf8_runes_from_left(const char* str, size_t rune_index);
 
 /*
  * Inserts str into dest starting from the given UTF8 rune index.
@@ -51,3 +89,87 @@ char* utf8_insert(char* dest, const size_t rune_index, const char* src);
  * Automatically resizes dest and returns it.
  */
 char* utf8_remove(char* dest, const size_t rune_index, const size_t rune_count);
+
+/*
+ * Rune index and byte offset of the same point in a string.
+ */
+typedef struct {
+	size_t rune;
+	size_t byte;
+} utf8_checkpoint;
+
+/*
+ * A UTF8 string that tracks its length in bytes and its allocated capacity.
+ * Edits happen in place and the capacity grows geometrically, so steady state
+ * editing doesn't allocate. A zeroed utf8_buf is a valid empty string, and
+ * data is always null terminated once anything has been added.
+ *
+ * Once utf8_buf_index is called the buffer also keeps a checkpoint roughly
+ * every UTF8_CHECKPOINT_RUNES runes, updated as it is edited, so rune indexes
+ * resolve to byte offsets without scanning from the start.
+ */
+typedef struct {
+	char* data;
+	size_t len;
+	size_t cap;
+
+	bool indexed;
+	utf8_checkpoint* checkpoints;
+	size_t checkpoint_count;
+	size_t checkpoint_cap;
+} utf8_buf;
+
+#define UTF8_CHECKPOINT_RUNES 64
+
+/*
+ * Ensures the buffer has room for a string of len bytes.
+ * Returns false if the allocation fails.
+ */
+bool utf8_buf_reserve(utf8_buf* buf, const size_t len);
+
+/*
+ * Builds the rune checkpoint index of the buffer and keeps it up to date
+ * through later edits.
+ * Returns false if the allocation fails.
+ */
+bool utf8_buf_index(utf8_buf* buf);
+
+/*
+ * Finds the byte offset corresponding to the given index of the UTF8 rune in
+ * the buffer.
+ */
+size_t utf8_buf_rune_to_byte_index(utf8_buf* buf, size_t rune_index);
+
+/*
+ * Returns a malloc'd substring of runes from the buffer start.
+ */
+char* utf8_buf_runes_from_left(utf8_buf* buf, size_t rune_index);
+
+/*
+ * Appends src to the buffer.
+ * Returns false if the allocation fails.
+ */
+bool utf8_buf_append(utf8_buf* buf, const char* src);
+
+/*
+ * Prepends src to the buffer.
+ * Returns false if the allocation fails.
+ */
+bool utf8_buf_prepend(utf8_buf* buf, const char* src);
+
+/*
+ * Inserts src into the buffer starting from the given UTF8 rune index.
+ * Returns false if the allocation fails.
+ */
+bool utf8_buf_insert(utf8_buf* buf, const size_t rune_index, const char* src);
+
+/*
+ * Removes a given count of UTF8 runes from the buffer starting from the given
+ * index. The capacity is kept for later edits.
+ */
+void utf8_buf_remove(utf8_buf* buf, const size_t rune_index, const size_t rune_count);
+
+/*
+ * Frees the buffer's string and index and resets it to empty.
+ */
+void utf8_buf_free(utf8_buf* buf);
@@ -0,0 +1,140 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench_util.h"
+#include "utf8.h"
+
+#define BENCH_BYTES (64 * 1024 * 1024)
+#define BENCH_ROUNDS 10
+
+// Malformed runes and the codepoints they have to decode to
+typedef struct {
+	const char* name;
+	const char* bytes;
+	size_t len;
+	uint32_t codepoints[4];
+	size_t count;
+} decode_check;
+
+static const decode_check decode_checks[] = {
+	{ "overlong nul", "\xC0\x80", 2, { 0xFFFD, 0xFFFD }, 2 },
+	{ "overlong del", "\xC1\xBF", 2, { 0xFFFD, 0xFFFD }, 2 },
+	{ "overlong 3 byte nul", "\xE0\x80\x80", 3, { 0xFFFD, 0xFFFD, 0xFFFD }, 3 },
+	{ "surrogate", "\xED\xA0\x80", 3, { 0xFFFD, 0xFFFD, 0xFFFD }, 3 },
+	{ "past U+10FFFF", "\xF4\x90\x80\x80", 4, { 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD }, 4 },
+	{ "past F4", "\xF5\x80", 2, { 0xFFFD, 0xFFFD }, 2 },
+	{ "last rune", "\xF4\x8F\xBF\xBF", 4, { 0x10FFFF }, 1 },
+	{ "first 3 byte rune", "\xE0\xA0\x80", 3, { 0x800 }, 1 },
+};
+
+// Returns how many of the decode checks the kernel and utf8_decode fail
+static int
+check_decode(void)
+{
+	int failed = 0;
+	for (size_t c = 0; c < sizeof(decode_checks) / sizeof(decode_checks[0]); c++) {
+		const decode_check* check = &decode_checks[c];
+		uint32_t out[4];
+		size_t count = utf8_decode_n(check->bytes, check->len, out);
+		bool ok = count == check->count && memcmp(out, check->codepoints, count * sizeof(uint32_t)) == 0;
+
+		size_t len = 0;
+		ok = ok && utf8_decode(check->bytes, &len) == check->codepoints[0];
+
+		if (!ok) {
+			printf("decode check failed: %s\n", check->name);
+			failed++;
+		}
+	}
+	return failed;
+}
+
+static char*
+fill(const char* sample, size_t* len)
+{
+	size_t sample_len = strlen(sample);
+	size_t count = BENCH_BYTES / sample_len;
+	char* buf = malloc(count * sample_len + 1);
+
+	for (size_t i = 0; i < count; i++) {
+		memcpy(&buf[i * sample_len], sample, sample_len);
+	}
+	buf[count * sample_len] = '\0';
+
+	*len = count * sample_len;
+	return buf;
+}
+
+// Byte at a time loop the kernels are measured against
+static size_t
+naive_count(const char* str, size_t len)
+{
+	size_t runes = 0;
+	for (size_t i = 0; i < len; i++) {
+		if (utf8_is_rune_start(str[i])) {
+			runes++;
+		}
+	}
+	return runes;
+}
+
+static void
+report(const char* script, const char* op, size_t len, double seconds, size_t result)
+{
+	double gbps = (double) len * BENCH_ROUNDS / seconds / 1e9;
+	printf("%-6s %-10s %8.2f GB/s  (%zu runes)\n", script, op, gbps, result);
+}
+
+int
+main(void)
+{
+	printf("kernel: %s, %d MiB x %d rounds\n", utf8_kernel_name(), BENCH_BYTES / (1024 * 1024), BENCH_ROUNDS);
+
+	if (check_decode() > 0) {
+		return EXIT_FAILURE;
+	}
+
+	for (size_t s = 0; s < bench_script_count; s++) {
+		size_t len = 0;
+		char* buf = fill(bench_scripts[s].sample, &len);
+		volatile size_t sink = 0;
+		size_t runes = 0;
+		double start = 0;
+
+		start = bench_seconds();
+		for (int r = 0; r < BENCH_ROUNDS; r++) {
+			sink += naive_count(buf, len);
+		}
+		report(bench_scripts[s].name, "naive", len, bench_seconds() - start, naive_count(buf, len));
+
+		start = bench_seconds();
+		for (int r = 0; r < BENCH_ROUNDS; r++) {
+			sink += utf8_rune_count_n(buf, len);
+		}
+		report(bench_scripts[s].name, "count", len, bench_seconds() - start, utf8_rune_count_n(buf, len));
+
+		start = bench_seconds();
+		for (int r = 0; r < BENCH_ROUNDS; r++) {
+			bool valid = utf8_validate(buf, len, &runes);
+			sink += valid;
+		}
+		report(bench_scripts[s].name, "validate", len, bench_seconds() - start, runes);
+
+		uint32_t* codepoints = malloc(len * sizeof(uint32_t));
+		start = bench_seconds();
+		for (int r = 0; r < BENCH_ROUNDS; r++) {
+			runes = utf8_decode_n(buf, len, codepoints);
+			sink += codepoints[runes - 1];
+		}
+		report(bench_scripts[s].name, "decode", len, bench_seconds() - start, runes);
+
+		(void) sink;
+		free(codepoints);
+		free(buf);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,314 @@
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "glyph.h"
+#include "wrap.h"
+#include "stb_ds.h"
+
+typedef struct {
+	// Index from the paragraph start of the first glyph of each row after
+	// the first
+	size_t* breaks;
+
+	// Width the breaks were made for, 0 if the paragraph needs wrapping
+	int width;
+} wrap_paragraph;
+
+struct wrap_layout {
+	wrap_paragraph* paragraphs;
+	int width;
+};
+
+// Finds where the line starts in the text and how many glyphs it has
+static void
+wrap_line_span(glyph_buffer* text, size_t line, size_t* start, size_t* len)
+{
+	*start = glyph_line_start(text, line);
+	size_t end = glyph_line_start(text, line + 1);
+
+	// Leave out the newline ending the line
+	if (line + 1 < glyph_line_count(text)) {
+		end--;
+	}
+
+	*len = end - *start;
+}
+
+// Returns the number of breaks at or before the index
+static size_t
+wrap_breaks_upto(const size_t* breaks, size_t index)
+{
+	size_t lo = 0;
+	size_t hi = arrlenu(breaks);
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (breaks[mid] <= index) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/*
+ * Greedily breaks the len glyphs of a paragraph at start into rows, beginning
+ * with a row at from, and appends the start of every row after it to breaks.
+ * Rows break after the last space that fits, or mid word if there isn't one.
+ *
+ * Once a break at or past converge_from lands on one of the old breaks moved
+ * by delta, the rows after it are the same as before, so the rest of the old
+ * breaks are reused. Returns whether that happened, with the row ending at
+ * that break in converged_row.
+ */
+static bool
+wrap_run(wrap_layout* layout, glyph_buffer* text, size_t start, size_t len, size_t from, size_t** breaks, const size_t* old, ptrdiff_t delta, size_t converge_from, size_t* converged_row)
+{
+	size_t old_count = arrlenu(old);
+	size_t j = 0;
+	bool converged = false;
+
+	size_t row = from;
+	int64_t row_w = 0;
+	size_t opportunity = from;
+	int64_t opportunity_w = 0;
+
+	size_t i = from;
+	glyph_iter it = glyph_iter_at(text, start + from);
+	glyph_span span;
+
+	while (!converged && i < len && glyph_iter_next(&it, &span)) {
+		for (size_t g = 0; g < span.len && i < len && !converged; g++, i++) {
+			int w = span.w[g] + span.kern[g];
+			bool space = span.codepoints[g] == ' ';
+
+			// Spaces hang past the edge rather than starting a row
+			while (!space && i > row && row_w + w > layout->width) {
+				size_t brk = opportunity > row ? opportunity : i;
+				row_w -= brk == i ? row_w : opportunity_w;
+				row = brk;
+				opportunity = row;
+				opportunity_w = 0;
+				arrput(*breaks, row);
+
+				if (row < converge_from) {
+					continue;
+				}
+
+				while (j < old_count && (ptrdiff_t) old[j] + delta < (ptrdiff_t) row) {
+					j++;
+				}
+
+				if (j < old_count && (ptrdiff_t) old[j] + delta == (ptrdiff_t) row) {
+					*converged_row = arrlenu(*breaks) - 1;
+					for (j++; j < old_count; j++) {
+						arrput(*breaks, (size_t) ((ptrdiff_t) old[j] + delta));
+					}
+					converged = true;
+					break;
+				}
+			}
+
+			row_w += w;
+			if (space) {
+				opportunity = i + 1;
+				opportunity_w = row_w;
+			}
+		}
+	}
+
+	glyph_iter_free(&it);
+	return converged;
+}
+
+// Returns the paragraph of the line, wrapping it first if it is out of date
+static wrap_paragraph*
+wrap_paragraph_at(wrap_layout* layout, glyph_buffer* text, size_t line)
+{
+	if (line >= arrlenu(layout->paragraphs)) {
+		line = arrlenu(layout->paragraphs) - 1;
+	}
+
+	wrap_paragraph* p = &layout->paragraphs[line];
+	if (p->width != layout->width) {
+		size_t start = 0;
+		size_t len = 0;
+		size_t converged_row = 0;
+		wrap_line_span(text, line, &start, &len);
+		arrfree(p->breaks);
+		wrap_run(layout, text, start, len, 0, &p->breaks, NULL, 0, 0, &converged_row);
+		p->width = layout->width;
+	}
+
+	return p;
+}
+
+wrap_layout*
+wrap_create(void)
+{
+	wrap_layout* layout = calloc(1, sizeof(wrap_layout));
+	if (!layout) {
+		return NULL;
+	}
+
+	layout->width = 1;
+	arrput(layout->paragraphs, ((wrap_paragraph){ .breaks = NULL, .width = 0 }));
+
+	return layout;
+}
+
+void
+wrap_free(wrap_layout* layout)
+{
+	if (!layout) {
+		return;
+	}
+
+	for (size_t i = 0; i < arrlenu(layout->paragraphs); i++) {
+		arrfree(layout->paragraphs[i].breaks);
+	}
+	arrfree(layout->paragraphs);
+	free(layout);
+}
+
+int
+wrap_width(wrap_layout* layout)
+{
+	return layout->width;
+}
+
+void
+wrap_set_width(wrap_layout* layout, int width)
+{
+	// Every paragraph wrapped at the old width is now out of date
+	layout->width = width > 1 ? width : 1;
+}
+
+wrap_damage
+wrap_edit(wrap_layout* layout, glyph_buffer* text, size_t index, size_t removed, size_t inserted)
+{
+	size_t line = glyph_line_of(text, index);
+	wrap_damage damage = { .line = line, .first_row = 0, .last_row = 0, .shifted = true };
+
+	// Keep one paragraph per line, the ones split off by the edit start unwrapped
+	ptrdiff_t line_delta = (ptrdiff_t) glyph_line_count(text) - (ptrdiff_t) arrlenu(layout->paragraphs);
+	if (line_delta > 0) {
+		size_t count = arrlenu(layout->paragraphs);
+		arrsetlen(layout->paragraphs, count + (size_t) line_delta);
+		memmove(&layout->paragraphs[line + 1 + line_delta], &layout->paragraphs[line + 1], (count - line - 1) * sizeof(wrap_paragraph));
+		for (size_t i = line + 1; i <= line + (size_t) line_delta; i++) {
+			layout->paragraphs[i] = (wrap_paragraph){ .breaks = NULL, .width = 0 };
+		}
+	} else if (line_delta < 0) {
+		for (size_t i = line + 1; i <= line + (size_t) -line_delta; i++) {
+			arrfree(layout->paragraphs[i].breaks);
+		}
+		arrdeln(layout->paragraphs, line + 1, (size_t) -line_delta);
+	}
+
+	wrap_paragraph* p = &layout->paragraphs[line];
+	if (p->width != layout->width) {
+		p = wrap_paragraph_at(layout, text, line);
+		damage.last_row = arrlenu(p->breaks);
+		return damage;
+	}
+
+	size_t start = 0;
+	size_t len = 0;
+	wrap_line_span(text, line, &start, &len);
+	size_t at = index - start;
+
+	// An edit can pull the start of its row back onto the row before, so
+	// wrapping restarts there. Rows that break mid word are all one word that
+	// might now fit after the row before it, so those are redone too.
+	size_t* old = p->breaks;
+	size_t old_count = arrlenu(old);
+	size_t row = wrap_breaks_upto(old, at);
+	size_t first = row;
+	while (first > 0 && glyph_get(text, start + old[first - 1] - 1).codepoint != ' ') {
+		first--;
+	}
+	first = first > 0 ? first - 1 : 0;
+	size_t from = first > 0 ? old[first - 1] : 0;
+
+	size_t* breaks = NULL;
+	arrsetlen(breaks, first);
+	for (size_t i = 0; i < first; i++) {
+		breaks[i] = old[i];
+	}
+
+	// Breaks after a change of lines belong to other paragraphs now
+	ptrdiff_t delta = (ptrdiff_t) inserted - (ptrdiff_t) removed;
+	size_t converged_row = 0;
+	bool converged = wrap_run(layout, text, start, len, from, &breaks, line_delta == 0 ? old : NULL, delta, at + inserted, &converged_row);
+
+	// The first changed row is the first one ending somewhere new, or the
+	// edited row itself
+	size_t count = arrlenu(breaks);
+	damage.first_row = row;
+	for (size_t k = first; k < row; k++) {
+		if (k >= count || breaks[k] != old[k]) {
+			damage.first_row = k;
+			break;
+		}
+	}
+	if (damage.first_row > count) {
+		damage.first_row = count;
+	}
+	damage.last_row = converged ? converged_row : count;
+	damage.shifted = line_delta != 0 || count != old_count;
+
+	arrfree(old);
+	p->breaks = breaks;
+
+	return damage;
+}
+
+size_t
+wrap_rows(wrap_layout* layout, glyph_buffer* text, size_t line)
+{
+	return arrlenu(wrap_paragraph_at(layout, text, line)->breaks) + 1;
+}
+
+size_t
+wrap_row_start(wrap_layout* layout, glyph_buffer* text, size_t line, size_t row)
+{
+	wrap_paragraph* p = wrap_paragraph_at(layout, text, line);
+	size_t start = glyph_line_start(text, line);
+
+	if (row == 0 || arrlenu(p->breaks) == 0) {
+		return start;
+	}
+
+	if (row > arrlenu(p->breaks)) {
+		row = arrlenu(p->breaks);
+	}
+
+	return start + p->breaks[row - 1];
+}
+
+size_t
+wrap_row_end(wrap_layout* layout, glyph_buffer* text, size_t line, size_t row)
+{
+	wrap_paragraph* p = wrap_paragraph_at(layout, text, line);
+	size_t start = 0;
+	size_t len = 0;
+	wrap_line_span(text, line, &start, &len);
+
+	if (row < arrlenu(p->breaks)) {
+		return start + p->breaks[row];
+	}
+
+	return start + len;
+}
+
+size_t
+wrap_row_of(wrap_layout* layout, glyph_buffer* text, size_t index)
+{
+	size_t line = glyph_line_of(text, index);
+	wrap_paragraph* p = wrap_paragraph_at(layout, text, line);
+	return wrap_breaks_upto(p->breaks, index - glyph_line_start(text, line));
+}
@@ -0,0 +1,72 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "glyph.h"
+
+/*
+ * Soft wrap layout of a glyph buffer. Every paragraph (line between newlines)
+ * caches the positions its rows break at, and is only wrapped the first time
+ * its rows are asked for after being edited or after the width changed.
+ */
+typedef struct wrap_layout wrap_layout;
+
+/*
+ * Rows of a paragraph that changed in an edit.
+ */
+typedef struct {
+	size_t line;
+	size_t first_row;
+	size_t last_row;
+	bool shifted;
+} wrap_damage;
+
+/*
+ * Creates a wrap layout for an empty glyph buffer.
+ */
+wrap_layout* wrap_create(void);
+
+/*
+ * Frees the wrap layout.
+ */
+void wrap_free(wrap_layout* layout);
+
+/*
+ * Returns the width in pixels rows are wrapped to.
+ */
+int wrap_width(wrap_layout* layout);
+
+/*
+ * Sets the width in pixels rows are wrapped to. Paragraphs are re-wrapped as
+ * their rows are next asked for, so the visible ones are wrapped first.
+ */
+void wrap_set_width(wrap_layout* layout, int width);
+
+/*
+ * Updates the layout after count glyphs at the index were replaced with
+ * inserted glyphs in the text. Only the edited paragraph is re-wrapped, from
+ * the row before the edit up to where its breaks line up with the old ones.
+ * Returns the rows that changed. If shifted is set every row after them moved
+ * as well.
+ */
+wrap_damage wrap_edit(wrap_layout* layout, glyph_buffer* text, size_t index, size_t removed, size_t inserted);
+
+/*
+ * Returns the number of rows the line is wrapped into.
+ */
+size_t wrap_rows(wrap_layout* layout, glyph_buffer* text, size_t line);
+
+/*
+ * Returns the index of the first glyph of the row of the line.
+ */
+size_t wrap_row_start(wrap_layout* layout, glyph_buffer* text, size_t line, size_t row);
+
+/*
+ * Returns the index just past the last glyph of the row of the line, not
+ * counting the newline ending the line.
+ */
+size_t wrap_row_end(wrap_layout* layout, glyph_buffer* text, size_t line, size_t row);
+
+/*
+ * Returns the row of its line the glyph at the index is on.
+ */
+size_t wrap_row_of(wrap_layout* layout, glyph_buffer* text, size_t index);